@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sim.h"
+#include "bench.h"
+
+/* ******************************************************************
+   Benchmark driver.  The scenarios are parameter settings in the same
+   "name=value" form as a sweep grid, applied in order over the base
+   configuration, so they win over the command line for the parameters
+   they set.  Each is set up to run steadily, with no congestion
+   collapse, so that the timings measure the simulator; they keep the
+   default fixed timeout unless the command line changes it.  They run one
+   after another on the calling thread so that their timings don't
+   compete for cores.
+   *******************************************************************/
+
+struct scenario {
+  const char *name;
+  int msgs;                       /* messages at scale 1, over all the flows */
+  const char *params;
+};
+
+static const struct scenario scenarios[] = {
+  { "no_loss",        200000, "loss=0 corrupt=0 window=16" },
+  { "loss_10",        200000, "loss=0.1 corrupt=0 lambda=20 window=16" },
+  { "loss_30",        100000, "loss=0.3 corrupt=0 lambda=30 window=16" },
+  { "corrupt_heavy",  100000, "loss=0.05 corrupt=0.4 lambda=30 window=16" },
+  { "saturated",      200000, "lambda=0.5 loss=0.05 corrupt=0.05 backlog=64" },
+  { "large_window",   200000, "window=4096 lambda=0.2 bandwidth=200 prop-delay=100 jitter=2 "
+                              "loss=0.01 nack=1" },
+  { "flows_1000",     200000, "flows=1000 loss=0.05 lambda=20 window=16" },
+};
+
+#define NSCENARIOS (int)(sizeof(scenarios) / sizeof(scenarios[0]))
+
+static int setscenario(struct simconfig *cfg, const struct scenario *sc, double scale)
+{
+  char *copy, *spec, *eq, *save;
+  int ok = 1;
+
+  cfg->trace = 0;
+  if ((copy = strdup(sc->params)) == NULL)
+    return 0;
+  for (spec = strtok_r(copy, " ", &save); ok && spec != NULL; spec = strtok_r(NULL, " ", &save)) {
+    if ((eq = strchr(spec, '=')) == NULL) {
+      ok = 0;
+      break;
+    }
+    *eq = '\0';
+    ok = setparam(cfg, spec, eq + 1);
+  }
+  free(copy);
+  cfg->nsimmax = (int)(sc->msgs * scale / cfg->flows + 0.5);
+  if (cfg->nsimmax < 1)
+    cfg->nsimmax = 1;
+  return ok;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void writerow(FILE *fp, int format, int header, const char *name,
+                     const struct simresult *res, double wall)
+{
+  static const char *names[] = {
+    "msgs", "wall_time", "events", "events_per_sec", "peak_events",
+    "event_memory", "peak_rss_kb", "messages_delivered", "sim_time"
+  };
+  double values[sizeof(names) / sizeof(names[0])];
+  struct rusage ru;
+  int i, n = 0;
+
+  getrusage(RUSAGE_SELF, &ru);
+  values[n++] = res->nsim;
+  values[n++] = wall;
+  values[n++] = res->nevents;
+  values[n++] = wall > 0.0 ? res->nevents / wall : 0.0;
+  values[n++] = res->maxevents;
+  values[n++] = res->evmemory;
+  values[n++] = ru.ru_maxrss;
+  values[n++] = res->messages_delivered;
+  values[n++] = res->time;
+
+  if (format == STATS_JSON) {
+    fprintf(fp, "{\"scenario\": \"%s\"", name);
+    for (i = 0; i < n; i++)
+      fprintf(fp, ", \"%s\": %.10g", names[i], values[i]);
+    fprintf(fp, "}\n");
+  }
+  else {
+    if (header) {
+      fprintf(fp, "scenario");
+      for (i = 0; i < n; i++)
+        fprintf(fp, ",%s", names[i]);
+      fprintf(fp, "\n");
+    }
+    fprintf(fp, "%s", name);
+    for (i = 0; i < n; i++)
+      fprintf(fp, ",%.10g", values[i]);
+    fprintf(fp, "\n");
+  }
+  fflush(fp);
+}
+
+int runbench(const struct simconfig *base, double scale,
+             FILE *out, int format, int header)
+{
+  struct simconfig cfg;
+  struct simresult res;
+  double start;
+  int i;
+
+  for (i = 0; i < NSCENARIOS; i++) {
+    cfg = *base;
+    if (!setscenario(&cfg, &scenarios[i], scale)) {
+      printf("bad benchmark scenario %s\n", scenarios[i].name);
+      return 0;
+    }
+    start = now();
+    runsim(&cfg, &res);
+    writerow(out, format, header && i == 0, scenarios[i].name, &res, now() - start);
+  }
+  return 1;
+}
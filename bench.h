@@ -0,0 +1,11 @@
+/* The benchmark suite: a fixed set of scenarios, each run once on top
+   of the configuration given on the command line, reporting how fast
+   the simulator ran rather than how the protocol did.  scale multiplies
+   the number of messages of every scenario.  Each row has the wall
+   time, the events handled per second, the longest the event list got,
+   the memory held for events and the peak resident size of the process
+   so far. */
+
+/* returns 0 if a scenario could not be set up */
+extern int runbench(const struct simconfig *base, double scale,
+                    FILE *out, int format, int header);
@@ -0,0 +1,8 @@
+#include <stdio.h>
+#include <stddef.h>
+#include "ckpt.h"
+
+int xfer(FILE *fp, int saving, void *p, size_t n)
+{
+  return (saving ? fwrite(p, 1, n, fp) : fread(p, 1, n, fp)) == n;
+}
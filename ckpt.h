@@ -0,0 +1,12 @@
+/* needs stdio.h and stddef.h */
+
+/* Saving a checkpoint and restoring one go through the same code, which
+   moves each field one way or the other with xfer, so the two can't
+   disagree on the layout. */
+
+/* write n bytes at p to fp, or with saving 0 read them back; returns 0
+   on a short read or write */
+extern int xfer(FILE *fp, int saving, void *p, size_t n);
+
+/* move the variable x, in a function with fp and saving in scope */
+#define XFER(x) xfer(fp, saving, &(x), sizeof(x))
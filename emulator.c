@@ -24,6 +24,11 @@
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
    (although some can be lost).
+   - optionally each direction is a link with a bandwidth, a propagation
+   delay, jitter and a bounded queue, see the link model below.
+   - optionally many connections run at once, each an A and a B of its
+   own, on their own links or all sharing one, see struct flow, and
+   split between threads, see PARALLEL RUNS.
 
    Modifications (6/6/2008 - CLP): 
    - removed bidirectional GBN code and other code not used by prac. 
@@ -33,22 +38,52 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Building: the simulator is made of all the .c files in this directory
+   and needs threads for parameter sweeps and parallel runs, e.g.
+     cc -O2 -pthread *.c -o sr -lm
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
 #include "emulator.h"
 #include "sr.h"
+#include "sim.h"
+#include "sweep.h"
+#include "bench.h"
+#include "evlog.h"
+#include "trace.h"
+#include "hist.h"
+#include "spsc.h"
+#include "ckpt.h"
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  int evflow;             /* the connection the event belongs to, numbered over the run */
+  struct pkt pkt;         /* packet (if any) assoc w/ this event */
+  unsigned long evseq;    /* insertion order in its flow, used to break ties on evtime */
+  int heappos;            /* current index of this event in evheap */
+  struct event *next;     /* link in the free list while not in use */
 };
 
-struct event *evlist = NULL;   /* the event list */
+/* events are carved out of slabs and recycled through a free list, so
+   once the simulation has warmed up it never calls malloc or free */
+#define EVSLABSIZE 1024
+
+struct evslab {
+  struct event events[EVSLABSIZE];
+  struct evslab *next;
+};
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
@@ -58,45 +93,191 @@ struct event *evlist = NULL;   /* the event list */
 #define  OFF             0
 #define  ON              1
 
-int TRACE = 3;
-
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+/* random number streams, see jimsrand() */
+#define RNG_LOSS     0          /* is a packet lost? */
+#define RNG_CORRUPT  1          /* is a packet corrupted, and how? */
+#define RNG_DELAY    2          /* channel delay of a packet */
+#define RNG_ARRIVAL  3          /* time between messages from layer 5 */
+#define RNG_LENGTH   4          /* length of messages from layer 5 */
+#define NRNGSTREAMS  5
+
+/* one direction of the channel, the link from A or from B */
+struct channel {
+  float lastarrival;              /* latest arrival time of packets in flight on it */
+  /* the link model */
+  float txfree;                   /* when the link has sent everything given to it */
+  float *txdone;                  /* ring of when each packet on the link is sent */
+  int txfirst;
+  int txcount;
+};
+
+/* One connection: an A and a B with their own protocol state, timers,
+   random number streams and messages.  A run has --flows of them, each
+   with its own channel or, with --bottleneck, all sharing one. */
+struct flow {
+  void *proto;                    /* state of the protocol entities */
+  struct protostats stats;        /* statistics updated by GBN */
+  struct event *timers[2];        /* outstanding TIMER_INTERRUPT of A and B */
+  unsigned long evseqnext;
+  uint64_t rngstate[NRNGSTREAMS][4];
+  int nsim;                       /* number of messages from 5 to 4 so far */
+  int delivered;                  /* number delivered to layer 5 */
+
+  /* when each message on its way to A and to B came from layer 5, in a
+     ring, oldest first.  Only messages the protocol took are put in,
+     and it delivers them in order, so the oldest is the one that
+     tolayer5() is given next. */
+  float *born[2];
+  int bornfirst[2];
+  int borncount[2];
+  int borncap[2];
+};
+
+/* All the state of one simulation.  Each thread runs at most one
+   simulation at a time and reaches it through sim. */
+struct simulator {
+  struct simconfig cfg;
+
+  struct evslab *evslabs;         /* every slab allocated so far */
+  struct event *evfreelist;       /* events ready for reuse */
+
+  /* the event list is kept as a binary min-heap ordered by evtime */
+  struct event **evheap;
+  int evcount;                    /* number of events in the heap */
+  int evcapacity;                 /* allocated slots in evheap */
+  int nslabs;                     /* slabs in evslabs */
+  int maxevcount;                 /* the most events in the heap at once */
+  long long nevents;              /* events taken off the heap */
+
+  struct flow *flows;
+  int nflows;
+  int flowbase;                   /* the number of flows[0] in the run; see PARALLEL RUNS */
+  struct flow *fl;                /* the flow whose event is being handled */
+  int curflow;                    /* its index */
+  struct channel *chans;          /* from A and from B of each flow, or of all */
+  int nchans;
+
+  int nsim;                       /* number of messages from 5 to 4 so far */ 
+  float time;
+  int ntolayer3;                  /* number sent into layer 3 */
+  int nsent[2];                   /* number sent into layer 3 by A and by B */
+  int nlost;                      /* number lost in media */
+  int ncorrupt;                   /* number corrupted by media*/
+  int nqueuedrop;                 /* number dropped by a full link queue */
+  int messages_delivered;
+  long long bytes_delivered;
+
+
+  /* the event log being recorded, and the log replayed for the packets
+     of A and of B, each read by its own reader */
+  struct evlog *record;
+  struct evlog *replay[2];
+  struct evrecord send;           /* what happens to the packet being sent */
+  struct evrecord replayed;       /* what happened to it in the replayed log... */
+  int replaying;                  /* ...if there is one */
+
+  struct hist *latency;           /* time from layer 5 to delivery */
+
+  /* the time series written every sampleinterval */
+  FILE *samplefp;
+  float nextsample;
+  int lastsent, lastresent, lastdelivered;  /* the counters at the last sample */
+  int intervaln;                  /* deliveries since the last sample... */
+  double intervalsum, intervalmax;  /* ...and their latencies */
+
+  int checkpointed;               /* the checkpoint has been saved */
+
+  struct spsc *tolink;            /* in a parallel run through a bottleneck, where
+                                     packets go past the loss draw */
+};
+
+static _Thread_local struct simulator *sim;
+
+_Thread_local int TRACE = 3;
+_Thread_local struct protostats *stats;
 
 /****************************************************************************/
-/* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* jimsrand(): return a double in range [0,1).  The routine below is used to */
+/* isolate all random number generation in one location.  Each use of        */
+/* randomness (loss, corruption, delay, message arrivals) draws from its own */
+/* xoshiro256** stream, so changing one probability leaves the other random  */
+/* sequences untouched.  The streams are 2^128 draws apart, and the same     */
+/* seed gives the same sequences on every machine.                           */
 /****************************************************************************/
-double jimsrand(void) 
+static uint64_t rotl(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t rngnext(uint64_t *st)
+{
+  uint64_t result = rotl(st[1] * 5, 7) * 9;
+  uint64_t t = st[1] << 17;
+
+  st[2] ^= st[0];
+  st[3] ^= st[1];
+  st[1] ^= st[2];
+  st[0] ^= st[3];
+  st[2] ^= t;
+  st[3] = rotl(st[3], 45);
+  return result;
+}
+
+/* advance a stream by 2^128 draws */
+static void rngjump(uint64_t *st)
+{
+  static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                   0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+  uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  int i, b;
+
+  for (i = 0; i < 4; i++)
+    for (b = 0; b < 64; b++) {
+      if (jump[i] & ((uint64_t)1 << b)) {
+        s0 ^= st[0];
+        s1 ^= st[1];
+        s2 ^= st[2];
+        s3 ^= st[3];
+      }
+      rngnext(st);
+    }
+  st[0] = s0;
+  st[1] = s1;
+  st[2] = s2;
+  st[3] = s3;
+}
+
+/* seed the first stream of the first flow with splitmix64, then jump
+   ahead for each of the others, the streams of one flow after another;
+   a simulator with only some of the flows jumps past the ones before */
+static void rngseed(uint64_t seedval)
+{
+  uint64_t z, st[4];
+  int i, k, f;
+
+  for (i = 0; i < 4; i++) {
+    seedval += 0x9e3779b97f4a7c15ULL;
+    z = seedval;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    st[i] = z ^ (z >> 31);
+  }
+  for (f = 0; f < sim->flowbase + sim->nflows; f++)
+    for (k = 0; k < NRNGSTREAMS; k++) {
+      if (f > 0 || k > 0)
+        rngjump(st);
+      if (f >= sim->flowbase)
+        memcpy(sim->flows[f - sim->flowbase].rngstate[k], st, sizeof(st));
+    }
+}
+
+double jimsrand(int stream) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
-  double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
-    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  double x;
+
+  x = (rngnext(sim->fl->rngstate[stream]) >> 11) * (1.0 / 9007199254740992.0);  /* 53 random bits */
+  if (TRACEON(TRACE_SCHEDULER, 4))
+    tprintf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
@@ -104,41 +285,148 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+static struct event *allocevent(void)
 {
-  struct event *q,*qold;
+  struct evslab *slab;
+  struct event *p;
+  int i;
 
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
-  }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
-  }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
+  if (sim->evfreelist == NULL) {
+    slab = malloc(sizeof(struct evslab));
+    if (slab == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
-    }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+    slab->next = sim->evslabs;
+    sim->evslabs = slab;
+    sim->nslabs++;
+    for (i = EVSLABSIZE-1; i >= 0; i--) {
+      slab->events[i].next = sim->evfreelist;
+      sim->evfreelist = &slab->events[i];
     }
   }
+  p = sim->evfreelist;
+  sim->evfreelist = p->next;
+  return p;
+}
+
+static void freeevent(struct event *p)
+{
+  p->next = sim->evfreelist;
+  sim->evfreelist = p;
+}
+
+/* Ordering of the event heap.  Events fire in time order; when two events
+   have the same time the one inserted most recently fires first, which is
+   exactly where the old sorted-list insert placed it.  Between flows the
+   lower numbered flow goes first, so that the order within a flow does
+   not depend on the others. */
+static int evbefore(const struct event *p, const struct event *q)
+{
+  if (p->evtime != q->evtime)
+    return p->evtime < q->evtime;
+  if (p->evflow != q->evflow)
+    return p->evflow < q->evflow;
+  return p->evseq > q->evseq;
+}
+
+static void evswap(int i, int j)
+{
+  struct event *tmp = sim->evheap[i];
+
+  sim->evheap[i] = sim->evheap[j];
+  sim->evheap[j] = tmp;
+  sim->evheap[i]->heappos = i;
+  sim->evheap[j]->heappos = j;
+}
+
+static void siftup(int i)
+{
+  while (i > 0 && evbefore(sim->evheap[i], sim->evheap[(i-1)/2])) {
+    evswap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void siftdown(int i)
+{
+  int child;
+
+  for (;;) {
+    child = 2*i + 1;
+    if (child >= sim->evcount)
+      return;
+    if (child+1 < sim->evcount && evbefore(sim->evheap[child+1], sim->evheap[child]))
+      child++;
+    if (!evbefore(sim->evheap[child], sim->evheap[i]))
+      return;
+    evswap(i, child);
+    i = child;
+  }
+}
+
+/* make room in the heap for one more event */
+static void growheap(void)
+{
+  struct event **newheap;
+
+  if (sim->evcount < sim->evcapacity)
+    return;
+  sim->evcapacity = sim->evcapacity ? 2*sim->evcapacity : 64;
+  newheap = realloc(sim->evheap, sim->evcapacity * sizeof(struct event *));
+  if (newheap == 0) {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  sim->evheap = newheap;
+}
+
+/* put an event that already has its flow and evseq on the heap */
+static void pushevent(struct event *p)
+{
+  growheap();
+  p->heappos = sim->evcount;
+  sim->evheap[sim->evcount++] = p;
+  if (sim->evcount > sim->maxevcount)
+    sim->maxevcount = sim->evcount;
+  siftup(p->heappos);
+}
+
+void insertevent(struct event *p)
+{
+  if (TRACEON(TRACE_SCHEDULER, 3)) {
+    tprintf("            INSERTEVENT: time is %f\n",sim->time);
+    tprintf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  p->evflow = sim->flowbase + sim->curflow;
+  p->evseq = sim->fl->evseqnext++;
+  pushevent(p);
+}
+
+/* unlink an event from anywhere in the heap; the caller owns it afterwards */
+static void removeevent(struct event *p)
+{
+  int i = p->heappos;
+
+  sim->evcount--;
+  if (i == sim->evcount)
+    return;
+  sim->evheap[i] = sim->evheap[sim->evcount];
+  sim->evheap[i]->heappos = i;
+  siftup(i);
+  siftdown(sim->evheap[i]->heappos);
+}
+
+/* remove and return the earliest event, or NULL if none are left */
+static struct event *nextevent(void)
+{
+  struct event *p;
+
+  if (sim->evcount == 0)
+    return NULL;
+  p = sim->evheap[0];
+  removeevent(p);
+  return p;
 }
 
 void generate_next_arrival(void)
@@ -146,87 +434,713 @@ void generate_next_arrival(void)
   double x;
   struct event *evptr;
 
-  if (TRACE>2)
-    printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
+  if (TRACEON(TRACE_SCHEDULER, 3))
+    tprintf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  x = sim->cfg.lambda*jimsrand(RNG_ARRIVAL)*2;  /* x is uniform on [0,2*lambda] */
   /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
+  evptr = allocevent();
+  evptr->evtime =  sim->time + x;
   evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
+  if (sim->cfg.sr.bidirectional && (jimsrand(RNG_ARRIVAL)>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
   insertevent(evptr);
 } 
 
+static int evcompare(const void *p, const void *q)
+{
+  const struct event *a = *(struct event * const *)p;
+  const struct event *b = *(struct event * const *)q;
+
+  if (evbefore(a, b))
+    return -1;
+  return evbefore(b, a);
+}
+
 void printevlist(void)
 {
+  struct event **sorted;
   struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  int i;
+
+  tprintf("--------------\nEvent List Follows:\n");
+  sorted = malloc((sim->evcount ? sim->evcount : 1) * sizeof(struct event *));
+  if (sorted == 0) {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < sim->evcount; i++)
+    sorted[i] = sim->evheap[i];
+  qsort(sorted, sim->evcount, sizeof(struct event *), evcompare);
+  for (i = 0; i < sim->evcount; i++) {
+    q = sorted[i];
+    tprintf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  }
+  free(sorted);
+  tprintf("--------------\n");
+}
+
+/********************* SIMULATION PARAMETERS *******/
+/*  Parameters can be given on the command line or  */
+/*  in a config file, so that batch runs don't have */
+/*  to answer the prompts.  Without any options the */
+/*  simulator asks for them interactively.          */
+/****************************************************/
+
+static int statsformat = STATS_TEXT;
+static char *statsfile = NULL;    /* append the report here instead of stdout */
+static char *sweepgrid = NULL;    /* run a parameter sweep over this grid */
+static char *decodefile = NULL;   /* print this event log and exit */
+static double benchscale = 0.0;   /* run the benchmark suite at this scale */
+static int nthreads = 0;          /* sweep worker threads, 0 for one per core */
+
+static const char shortopts[] =
+  "n:l:c:d:a:t:F:s:w:p:m:B:W:D:J:U:Q:r:T:k:b:x:u:y:M:E:C:f:o:O:S:j:L:P:X:K:I:i:Z:z:N:e:R:g:G:Y:h";
+
+static struct option longopts[] = {
+  { "msgs",      required_argument, NULL, 'n' },
+  { "loss",      required_argument, NULL, 'l' },
+  { "corrupt",   required_argument, NULL, 'c' },
+  { "direction", required_argument, NULL, 'd' },
+  { "lambda",    required_argument, NULL, 'a' },
+  { "trace",     required_argument, NULL, 't' },
+  { "trace-filter", required_argument, NULL, 'F' },
+  { "seed",      required_argument, NULL, 's' },
+  { "window",    required_argument, NULL, 'w' },
+  { "payload",   required_argument, NULL, 'p' },
+  { "payload-min", required_argument, NULL, 'm' },
+  { "byte-time", required_argument, NULL, 'B' },
+  { "bandwidth", required_argument, NULL, 'W' },
+  { "prop-delay", required_argument, NULL, 'D' },
+  { "jitter",    required_argument, NULL, 'J' },
+  { "jitter-dist", required_argument, NULL, 'U' },
+  { "queue",     required_argument, NULL, 'Q' },
+  { "rto",       required_argument, NULL, 'r' },
+  { "timeout",   required_argument, NULL, 'T' },
+  { "nack",      required_argument, NULL, 'k' },
+  { "backlog",   required_argument, NULL, 'b' },
+  { "checksum",  required_argument, NULL, 'x' },
+  { "bidirectional", required_argument, NULL, 'u' },
+  { "ack-delay", required_argument, NULL, 'y' },
+  { "ack-mode",  required_argument, NULL, 'M' },
+  { "ack-every", required_argument, NULL, 'E' },
+  { "congestion", required_argument, NULL, 'C' },
+  { "flows",     required_argument, NULL, 'g' },
+  { "bottleneck", required_argument, NULL, 'G' },
+  { "parallel",  required_argument, NULL, 'Y' },
+  { "config",    required_argument, NULL, 'f' },
+  { "stats",     required_argument, NULL, 'o' },
+  { "stats-file", required_argument, NULL, 'O' },
+  { "sweep",     required_argument, NULL, 'S' },
+  { "threads",   required_argument, NULL, 'j' },
+  { "record",    required_argument, NULL, 'L' },
+  { "replay",    required_argument, NULL, 'P' },
+  { "decode",    required_argument, NULL, 'X' },
+  { "bench",     required_argument, NULL, 'K' },
+  { "samples",   required_argument, NULL, 'I' },
+  { "sample-interval", required_argument, NULL, 'i' },
+  { "checkpoint", required_argument, NULL, 'Z' },
+  { "checkpoint-at", required_argument, NULL, 'z' },
+  { "checkpoint-events", required_argument, NULL, 'N' },
+  { "checkpoint-exit", required_argument, NULL, 'e' },
+  { "restore",   required_argument, NULL, 'R' },
+  { "help",      no_argument,       NULL, 'h' },
+  { NULL, 0, NULL, 0 }
+};
+
+static void usage(const char *prog)
+{
+  struct simconfig def;
+
+  simdefaults(&def);
+  printf("usage: %s [options]\n", prog);
+  printf("  -n, --msgs=N         number of messages to simulate (default 1000)\n");
+  printf("  -l, --loss=P         packet loss probability (default 0.0)\n");
+  printf("  -c, --corrupt=P      packet corruption probability (default 0.0)\n");
+  printf("  -d, --direction=D    loss/corruption direction: 0 A->B, 1 A<-B, 2 A<->B (default 2)\n");
+  printf("  -a, --lambda=T       average time between messages from layer5 (default 10.0)\n");
+  printf("  -t, --trace=N        trace level (default 0)\n");
+  printf("  -F, --trace-filter=LIST  subsystems to trace: scheduler, channel, sender,\n");
+  printf("                       receiver or all, separated by commas (default all)\n");
+  printf("  -s, --seed=N         random number generator seed (default 9999)\n");
+  printf("  -w, --window=N       sender and receiver window size (default %d)\n", def.sr.windowsize);
+  printf("  -p, --payload=N      bytes in each message, at most %d in this build (default %d)\n", MAXPAYLOAD, def.payload);
+  printf("  -m, --payload-min=N  vary message lengths uniformly from N to --payload (default --payload)\n");
+  printf("  -B, --byte-time=T    transmission time per byte sent, added to the channel delay (default 0)\n");
+  printf("  -W, --bandwidth=R    link bandwidth in bytes per time unit, 0 for the original\n");
+  printf("                       1 to 10 time unit delay (default 0)\n");
+  printf("  -D, --prop-delay=T   link propagation delay (default %g)\n", def.link[A].propdelay);
+  printf("  -J, --jitter=T       link jitter, the most or the mean extra delay (default %g)\n", def.link[A].jitter);
+  printf("  -U, --jitter-dist=D  jitter distribution: uniform or exponential (default uniform)\n");
+  printf("  -Q, --queue=N        packets that can wait for the link, 0 for no limit (default 0)\n");
+  printf("                       the link options set both directions; in a config file or a\n");
+  printf("                       sweep add -ab or -ba to the name to set one, e.g. bandwidth-ba\n");
+  printf("  -r, --rto=MODE       retransmission timeout: fixed or adaptive (default fixed)\n");
+  printf("  -T, --timeout=T      the fixed timeout, and the first one when adaptive (default %g)\n", def.sr.timeout);
+  printf("  -b, --backlog=N      queue up to N messages while the window is full (default 0, drop them)\n");
+  printf("  -x, --checksum=ALG   packet checksum: sum, inet or crc32c (default sum)\n");
+  printf("  -u, --bidirectional=0|1  B sends messages to A too, half of them (default 0)\n");
+  printf("  -M, --ack-mode=MODE  single, an ACK per packet, or sack, a cumulative ACK with a\n");
+  printf("                       bitmap of the packets received after it (default single)\n");
+  printf("  -E, --ack-every=N    with --ack-mode=sack, ACK every N in-order packets (default %d)\n", def.sr.ackevery);
+  printf("  -y, --ack-delay=T    how long an ACK may wait for a data packet to ride on, with\n");
+  printf("                       --bidirectional, or for more packets with --ack-mode=sack\n");
+  printf("                       (default %g)\n", def.sr.ackdelay);
+  printf("  -C, --congestion=0|1 limit the packets in flight with an AIMD congestion window\n");
+  printf("                       (default 0)\n");
+  printf("  -g, --flows=N        run N connections, each an A and a B sending --msgs\n");
+  printf("                       messages with their own protocol state (default 1)\n");
+  printf("  -G, --bottleneck=0|1 the flows share one link each way instead of having one\n");
+  printf("                       each; see the link options (default 0)\n");
+  printf("  -Y, --parallel=N     split the flows between N threads, 0 for one per core,\n");
+  printf("                       with the same results as on one (default 1)\n");
+  printf("  -k, --nack=0|1       receiver NACKs gaps so the sender resends them at once (default 0)\n");
+  printf("  -f, --config=FILE    read parameters from FILE, one \"name = value\" per line\n");
+  printf("  -o, --stats=FORMAT   statistics report format: text, json or csv (default text)\n");
+  printf("  -O, --stats-file=F   append the json/csv report to F and keep the text report on stdout\n");
+  printf("  -S, --sweep=GRID     run every combination of the parameter values in GRID,\n");
+  printf("                       e.g. \"loss=0,0.1,0.2 lambda=5:20:5\" (ranges are start:stop:step)\n");
+  printf("  -j, --threads=N      sweep worker threads (default one per core)\n");
+  printf("  -L, --record=FILE    write every event and channel decision to a binary log\n");
+  printf("  -P, --replay=FILE    lose, corrupt and delay each side's packets as its packets\n");
+  printf("                       in a recorded log were, the n-th as the n-th\n");
+  printf("  -X, --decode=FILE    print a recorded log as text and exit\n");
+  printf("  -K, --bench=SCALE    time the benchmark scenarios on top of the other options,\n");
+  printf("                       with SCALE times their messages, and report as csv or json\n");
+  printf("  -I, --samples=FILE   write window occupancy, packets in flight, and send, resend\n");
+  printf("                       and delivery rates to FILE as csv, every --sample-interval\n");
+  printf("  -i, --sample-interval=T  simulated time between samples (default %g)\n", def.sampleinterval);
+  printf("  -Z, --checkpoint=FILE  save the whole state of the run to FILE, once, at the time\n");
+  printf("                       given by --checkpoint-at or --checkpoint-events\n");
+  printf("  -z, --checkpoint-at=T  save it before the first event after simulated time T\n");
+  printf("  -N, --checkpoint-events=N  save it once N events have run\n");
+  printf("  -e, --checkpoint-exit=0|1  end the run once it is saved (default 0)\n");
+  printf("  -R, --restore=FILE   carry on from a saved state; its parameters are the defaults,\n");
+  printf("                       and all but the window, backlog, direction, flows and links\n");
+  printf("                       can be changed, e.g. -n to run longer or a sweep of variants\n");
+  printf("with no options the parameters are read interactively\n");
+}
+
+static int parseint(const char *value, int *result)
+{
+  char *end;
+  long v = strtol(value, &end, 10);
+
+  if (end == value || *end != '\0')
+    return 0;
+  *result = (int)v;
+  return 1;
+}
+
+static int parsefloat(const char *value, float *result)
+{
+  char *end;
+  double v = strtod(value, &end);
+
+  if (end == value || *end != '\0')
+    return 0;
+  *result = (float)v;
+  return 1;
+}
+
+static int parsedouble(const char *value, double *result)
+{
+  char *end;
+  double v = strtod(value, &end);
+
+  if (end == value || *end != '\0')
+    return 0;
+  *result = v;
+  return 1;
+}
+
+static int parselong(const char *value, long long *result)
+{
+  char *end;
+  long long v = strtoll(value, &end, 10);
+
+  if (end == value || *end != '\0')
+    return 0;
+  *result = v;
+  return 1;
+}
+
+/* a comma separated list of subsystems to trace */
+static int parsetracemask(const char *value, int *result)
+{
+  static const struct { const char *name; int mask; } subsystems[] = {
+    { "scheduler", TRACE_SCHEDULER }, { "channel", TRACE_CHANNEL },
+    { "sender", TRACE_SENDER }, { "receiver", TRACE_RECEIVER }, { "all", TRACE_ALL }
+  };
+  const char *p = value;
+  size_t len;
+  int i, mask = 0;
+
+  while (*p != '\0') {
+    len = strcspn(p, ",");
+    for (i = 0; i < 5; i++)
+      if (strlen(subsystems[i].name) == len && strncmp(p, subsystems[i].name, len) == 0)
+        break;
+    if (i == 5)
+      return 0;
+    mask |= subsystems[i].mask;
+    p += len;
+    if (*p == ',')
+      p++;
   }
-  printf("--------------\n");
+  if (mask == 0)
+    return 0;
+  *result = mask;
+  return 1;
 }
 
-void init(void)                         /* initialize the simulator */
+void simdefaults(struct simconfig *cfg)
 {
-  float sum, avg;
   int i;
 
+  cfg->nsimmax = 1000;
+  cfg->lossprob = 0.0;
+  cfg->corruptprob = 0.0;
+  cfg->corruptdirection = 2;
+  cfg->lambda = 10.0;
+  cfg->trace = 0;
+  cfg->tracemask = TRACE_ALL;
+  cfg->seed = 9999;
+  cfg->payload = 20;
+  cfg->payloadmin = -1;   /* the same as payload */
+  cfg->bytetime = 0.0;
+  for (i = 0; i < 2; i++) {
+    cfg->link[i].bandwidth = 0.0;
+    cfg->link[i].propdelay = 1.0;
+    cfg->link[i].jitter = 9.0;
+    cfg->link[i].jitterdist = JITTER_UNIFORM;
+    cfg->link[i].queue = 0;
+  }
+  sr_defaults(&cfg->sr);
+  cfg->flows = 1;
+  cfg->bottleneck = 0;
+  cfg->parallel = 1;
+  cfg->record = NULL;
+  cfg->replay = NULL;
+  cfg->samples = NULL;
+  cfg->sampleinterval = 100.0;
+  cfg->checkpoint = NULL;
+  cfg->checkpointat = -1.0;
+  cfg->checkpointevents = 0;
+  cfg->checkpointexit = 0;
+  cfg->restore = NULL;
+}
+
+/* a link parameter; the name may end in -ab or -ba for one direction,
+   otherwise both are set.  Returns -1 if it is not a link parameter. */
+static int setlinkparam(struct simconfig *cfg, const char *name, const char *value)
+{
+  static const char *names[] = { "bandwidth", "prop-delay", "jitter", "jitter-dist", "queue" };
+  struct linkconfig link;
+  size_t len = strlen(name);
+  int first = A, last = B;
+  int k, ok;
+
+  if (len > 3 && strcmp(name + len - 3, "-ab") == 0)
+    last = A;
+  else if (len > 3 && strcmp(name + len - 3, "-ba") == 0)
+    first = B;
+  if (first == last)
+    len -= 3;
+  for (k = 0; k < 5; k++)
+    if (strlen(names[k]) == len && strncmp(name, names[k], len) == 0)
+      break;
+  if (k == 5)
+    return -1;
+
+  link = cfg->link[first];
+  if (k == 0)
+    ok = parsefloat(value, &link.bandwidth) && link.bandwidth >= 0.0;
+  else if (k == 1)
+    ok = parsefloat(value, &link.propdelay) && link.propdelay >= 0.0;
+  else if (k == 2)
+    ok = parsefloat(value, &link.jitter) && link.jitter >= 0.0;
+  else if (k == 3) {
+    ok = 1;
+    if (strcmp(value, "uniform") == 0)
+      link.jitterdist = JITTER_UNIFORM;
+    else if (strcmp(value, "exponential") == 0)
+      link.jitterdist = JITTER_EXPONENTIAL;
+    else
+      ok = 0;
+  }
+  else
+    ok = parseint(value, &link.queue) && link.queue >= 0;
+  if (!ok)
+    return 0;
+
+  /* only the parameter named is copied to the other direction */
+  for (; first <= last; first++) {
+    if (k == 0)
+      cfg->link[first].bandwidth = link.bandwidth;
+    else if (k == 1)
+      cfg->link[first].propdelay = link.propdelay;
+    else if (k == 2)
+      cfg->link[first].jitter = link.jitter;
+    else if (k == 3)
+      cfg->link[first].jitterdist = link.jitterdist;
+    else
+      cfg->link[first].queue = link.queue;
+  }
+  return 1;
+}
+
+int setparam(struct simconfig *cfg, const char *name, const char *value)
+{
+  int ok;
+  int n;
+
+  if (strcmp(name, "msgs") == 0)
+    ok = parseint(value, &cfg->nsimmax) && cfg->nsimmax >= 0;
+  else if (strcmp(name, "loss") == 0)
+    ok = parsefloat(value, &cfg->lossprob) && cfg->lossprob >= 0.0 && cfg->lossprob <= 1.0;
+  else if (strcmp(name, "corrupt") == 0)
+    ok = parsefloat(value, &cfg->corruptprob) && cfg->corruptprob >= 0.0 && cfg->corruptprob <= 1.0;
+  else if (strcmp(name, "direction") == 0)
+    ok = parseint(value, &cfg->corruptdirection) && cfg->corruptdirection >= 0 && cfg->corruptdirection <= 2;
+  else if (strcmp(name, "lambda") == 0)
+    ok = parsefloat(value, &cfg->lambda) && cfg->lambda > 0.0;
+  else if (strcmp(name, "trace") == 0) {
+    ok = parseint(value, &cfg->trace) && cfg->trace >= 0;
+    if (ok && cfg->trace > TRACE_MAX)
+      printf("note: this build only traces up to level %d\n", TRACE_MAX);
+  }
+  else if (strcmp(name, "trace-filter") == 0)
+    ok = parsetracemask(value, &cfg->tracemask);
+  else if (strcmp(name, "seed") == 0) {
+    ok = parseint(value, &n);
+    if (ok)
+      cfg->seed = (unsigned int)n;
+  }
+  else if (strcmp(name, "payload") == 0)
+    ok = parseint(value, &cfg->payload) && cfg->payload >= 1 && cfg->payload <= MAXPAYLOAD;
+  else if (strcmp(name, "payload-min") == 0)
+    ok = parseint(value, &cfg->payloadmin) && cfg->payloadmin >= 1 && cfg->payloadmin <= MAXPAYLOAD;
+  else if (strcmp(name, "byte-time") == 0)
+    ok = parsefloat(value, &cfg->bytetime) && cfg->bytetime >= 0.0;
+  else if (strcmp(name, "flows") == 0)
+    ok = parseint(value, &cfg->flows) && cfg->flows >= 1 && cfg->flows <= 1 << 20;
+  else if (strcmp(name, "bottleneck") == 0)
+    ok = parseint(value, &cfg->bottleneck) && (cfg->bottleneck == 0 || cfg->bottleneck == 1);
+  else if (strcmp(name, "sample-interval") == 0)
+    ok = parsefloat(value, &cfg->sampleinterval) && cfg->sampleinterval > 0.0;
+  else if ((ok = setlinkparam(cfg, name, value)) >= 0)
+    ;
+  else if ((ok = sr_setparam(&cfg->sr, name, value)) < 0) {
+    printf("unknown parameter: %s\n", name);
+    return 0;
+  }
+  if (!ok)
+    printf("invalid value for %s: %s\n", name, value);
+  return ok;
+}
+
+/* options of the front end itself, then the simulation parameters */
+static int setoption(struct simconfig *cfg, const char *name, const char *value)
+{
+  int ok = 1;
+
+  if (strcmp(name, "stats") == 0) {
+    if (strcmp(value, "text") == 0)
+      statsformat = STATS_TEXT;
+    else if (strcmp(value, "json") == 0)
+      statsformat = STATS_JSON;
+    else if (strcmp(value, "csv") == 0)
+      statsformat = STATS_CSV;
+    else
+      ok = 0;
+  }
+  else if (strcmp(name, "stats-file") == 0) {
+    free(statsfile);
+    statsfile = strdup(value);
+    ok = statsfile != NULL;
+  }
+  else if (strcmp(name, "sweep") == 0) {
+    free(sweepgrid);
+    sweepgrid = strdup(value);
+    ok = sweepgrid != NULL;
+  }
+  else if (strcmp(name, "threads") == 0)
+    ok = parseint(value, &nthreads) && nthreads >= 0;
+  else if (strcmp(name, "parallel") == 0)
+    ok = parseint(value, &cfg->parallel) && cfg->parallel >= 0;
+  else if (strcmp(name, "record") == 0) {
+    free(cfg->record);
+    cfg->record = strdup(value);
+    ok = cfg->record != NULL;
+  }
+  else if (strcmp(name, "replay") == 0) {
+    free(cfg->replay);
+    cfg->replay = strdup(value);
+    ok = cfg->replay != NULL;
+  }
+  else if (strcmp(name, "samples") == 0) {
+    free(cfg->samples);
+    cfg->samples = strdup(value);
+    ok = cfg->samples != NULL;
+  }
+  else if (strcmp(name, "checkpoint") == 0) {
+    free(cfg->checkpoint);
+    cfg->checkpoint = strdup(value);
+    ok = cfg->checkpoint != NULL;
+  }
+  else if (strcmp(name, "checkpoint-at") == 0)
+    ok = parsefloat(value, &cfg->checkpointat) && cfg->checkpointat >= 0.0;
+  else if (strcmp(name, "checkpoint-events") == 0)
+    ok = parselong(value, &cfg->checkpointevents) && cfg->checkpointevents > 0;
+  else if (strcmp(name, "checkpoint-exit") == 0)
+    ok = parseint(value, &cfg->checkpointexit) && (cfg->checkpointexit == 0 || cfg->checkpointexit == 1);
+  else if (strcmp(name, "bench") == 0)
+    ok = parsedouble(value, &benchscale) && benchscale > 0.0;
+  else if (strcmp(name, "decode") == 0) {
+    free(decodefile);
+    decodefile = strdup(value);
+    ok = decodefile != NULL;
+  }
+  else
+    return setparam(cfg, name, value);
+  if (!ok)
+    printf("invalid value for %s: %s\n", name, value);
+  return ok;
+}
+
+/* strip leading and trailing white space in place */
+static char *trim(char *str)
+{
+  char *end;
+
+  while (*str == ' ' || *str == '\t')
+    str++;
+  end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+    end--;
+  *end = '\0';
+  return str;
+}
+
+/* read "name = value" lines from a config file; '#' starts a comment */
+static int readconfig(struct simconfig *cfg, const char *path)
+{
+  FILE *fp;
+  char line[256];
+  char *name, *value, *p;
+  int lineno = 0;
+  int ok = 1;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("cannot open config file %s\n", path);
+    return 0;
+  }
+  while (ok && fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if ((p = strchr(line, '#')) != NULL)
+      *p = '\0';
+    name = trim(line);
+    if (*name == '\0')
+      continue;
+    if ((p = strchr(name, '=')) == NULL) {
+      printf("%s:%d: expected name = value\n", path, lineno);
+      ok = 0;
+      break;
+    }
+    *p = '\0';
+    value = trim(p + 1);
+    ok = setoption(cfg, trim(name), value);
+  }
+  fclose(fp);
+  return ok;
+}
+
+/* read the parameters the old way, prompting for each one */
+static void readinteractive(struct simconfig *cfg)
+{
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
   printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
+  scanf("%d",&cfg->nsimmax);
   printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
+  scanf("%f",&cfg->lossprob);
   printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
+  scanf("%f",&cfg->corruptprob);
+  if (cfg->lossprob != 0.0 || cfg->corruptprob != 0.0) {
     printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
+    scanf("%d",&cfg->corruptdirection);
   }
   printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
+  scanf("%f",&cfg->lambda);
   printf("Enter TRACE:");
-  scanf("%d",&TRACE);
-
-
-  srand(9999);              /* init random number generator */
-  sum = 0.0;                /* test random number generator for students */
-  for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
-  avg = sum/1000.0;
-  if (avg < 0.25 || avg > 0.75) {
-    printf("It is likely that random number generation on your machine\n" ); 
-    printf("is different from what this emulator expects.  Please take\n");
-    printf("a look at the routine jimsrand() in the emulator code. Sorry. \n");
+  scanf("%d",&cfg->trace);
+}
+
+static int loadconfig(struct simconfig *, const char *path);
+
+static void readparams(int argc, char **argv, struct simconfig *cfg)
+{
+  int c;
+  int idx;
+
+  simdefaults(cfg);
+  if (argc <= 1) {
+    /* the direction is only asked for when there is loss or corruption */
+    cfg->corruptdirection = 0;
+    readinteractive(cfg);
+    return;
+  }
+  /* the parameters of a checkpoint being restored take the place of the
+     defaults, so it is read before the options that change them */
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, shortopts, longopts, &idx)) != -1)
+    if (c == 'R' && !loadconfig(cfg, optarg))
+      exit(EXIT_FAILURE);
+  opterr = 1;
+  optind = 0;
+  while ((c = getopt_long(argc, argv, shortopts, longopts, &idx)) != -1) {
+    if (c == 'R')
+      continue;
+    if (c == 'h') {
+      usage(argv[0]);
+      exit(EXIT_SUCCESS);
+    }
+    if (c == '?')
+      exit(EXIT_FAILURE);
+    for (idx = 0; longopts[idx].val != c; idx++)
+      ;
+    if (c == 'f') {
+      if (!readconfig(cfg, optarg))
+        exit(EXIT_FAILURE);
+    }
+    else if (!setoption(cfg, longopts[idx].name, optarg))
+      exit(EXIT_FAILURE);
+  }
+  if (optind < argc) {
+    printf("unexpected argument: %s\n", argv[optind]);
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* make flow f the one the protocol, the timers and the channel act for */
+static void setflow(int f)
+{
+  sim->curflow = f;
+  sim->fl = &sim->flows[f];
+  sr_select(sim->fl->proto);
+  stats = &sim->fl->stats;
+}
+
+/* set up the simulation of count flows from first on the current
+   thread; without their protocols it only has their channels and
+   random number streams, for the link of a parallel run */
+static void init(const struct simconfig *cfg, int first, int count, int protocols)
+{
+  int i, f;
+
+  sim = calloc(1, sizeof(struct simulator));
+  if (sim == 0) {
+    printf("memory allocation for simulator failed.");
+    exit(EXIT_FAILURE);
+  }
+  sim->cfg = *cfg;
+  TRACE = cfg->trace;
+  TRACEMASK = cfg->tracemask;
+
+  sim->nflows = count;
+  sim->flowbase = first;
+  sim->nchans = 2 * (cfg->bottleneck ? 1 : count);
+  sim->flows = calloc(sim->nflows, sizeof(struct flow));
+  sim->chans = calloc(sim->nchans, sizeof(struct channel));
+  if (sim->flows == NULL || sim->chans == NULL) {
+    printf("memory allocation for flows failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < sim->nchans; i++)
+    if (cfg->link[i % 2].bandwidth > 0.0 && cfg->link[i % 2].queue > 0) {
+      sim->chans[i].txdone = calloc(cfg->link[i % 2].queue + 1, sizeof(float));
+      if (sim->chans[i].txdone == NULL) {
+        printf("memory allocation for link queue failed.");
+        exit(EXIT_FAILURE);
+      }
+    }
+  for (f = 0; f < sim->nflows && protocols; f++) {
+    sim->flows[f].proto = sr_create(&cfg->sr);
+    setflow(f);
+    A_init();
+    B_init();
+  }
+
+  for (i = 0; i < 2 && cfg->replay != NULL; i++)
+    if ((sim->replay[i] = evlog_open(cfg->replay, 0)) == NULL)
+      exit(EXIT_FAILURE);
+  if (cfg->record != NULL && (sim->record = evlog_open(cfg->record, 1)) == NULL)
+    exit(EXIT_FAILURE);
+
+  sim->latency = calloc(1, sizeof(struct hist));
+  if (sim->latency == NULL) {
+    printf("memory allocation for latency histogram failed.");
     exit(EXIT_FAILURE);
   }
+  if (cfg->samples != NULL) {
+    if ((sim->samplefp = fopen(cfg->samples, "w")) == NULL) {
+      printf("cannot open sample file %s\n", cfg->samples);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(sim->samplefp, "time,window_a,inflight_a,queued_a,cwnd_a,"
+            "window_b,inflight_b,queued_b,cwnd_b,send_rate,resend_rate,"
+            "delivery_rate,latency_mean,latency_max\n");
+    sim->nextsample = cfg->sampleinterval;
+  }
+
+  if (cfg->restore != NULL)
+    return;                    /* the state comes from the checkpoint */
+  rngseed(cfg->seed);       /* init random number generator */
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
+  sim->time=0.0;               /* initialize time to 0.0 */
+  for (f = 0; f < sim->nflows && protocols; f++) {
+    setflow(f);
+    generate_next_arrival();   /* initialize event list */
+  }
+}
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+/* release everything the simulation on this thread allocated */
+static void cleanup(void)
+{
+  struct evslab *slab;
+  int i;
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  while ((slab = sim->evslabs) != NULL) {
+    sim->evslabs = slab->next;
+    free(slab);
+  }
+  free(sim->evheap);
+  for (i = 0; i < sim->nchans; i++)
+    free(sim->chans[i].txdone);
+  free(sim->chans);
+  if (sim->record != NULL)
+    evlog_close(sim->record);
+  if (sim->replay[A] != NULL)
+    evlog_close(sim->replay[A]);
+  if (sim->replay[B] != NULL)
+    evlog_close(sim->replay[B]);
+  if (sim->samplefp != NULL)
+    fclose(sim->samplefp);
+  for (i = 0; i < sim->nflows; i++) {
+    free(sim->flows[i].born[A]);
+    free(sim->flows[i].born[B]);
+    if (sim->flows[i].proto != NULL)
+      sr_destroy(sim->flows[i].proto);
+  }
+  free(sim->flows);
+  free(sim->latency);
+  free(sim);
+  sim = NULL;
+  stats = NULL;
 }
 
 /********************** Student-callable ROUTINES ***********************/
@@ -235,30 +1149,16 @@ void init(void)                         /* initialize the simulator */
 void stoptimer(int AorB)
 /* A or B is trying to stop timer */
 {
-  struct event *q;
-
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
-  printf("Warning: unable to cancel your timer. It wasn't running.\n");
+  if (TRACEON(TRACE_SCHEDULER, 2))
+    tprintf("          STOP TIMER: stopping timer at %f\n",sim->time);
+  if (sim->fl->timers[AorB] != NULL) {
+    /* remove this event */
+    removeevent(sim->fl->timers[AorB]);
+    freeevent(sim->fl->timers[AorB]);
+    sim->fl->timers[AorB] = NULL;
+    return;
+  }
+  tprintf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
 
@@ -266,213 +1166,1457 @@ void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-  struct event *q;
   struct event *evptr;
 
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+  if (TRACEON(TRACE_SCHEDULER, 2))
+    tprintf("          START TIMER: starting timer at %f\n",sim->time);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (sim->fl->timers[AorB] != NULL) {
+    tprintf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
+  evptr = allocevent();
+  evptr->evtime =  sim->time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
   insertevent(evptr);
+  sim->fl->timers[AorB] = evptr;
 } 
 
 
-/************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
-/* A or B is sending to network  */
+float currenttime(void)
 {
-  struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  return sim->time;
+}
 
-  ntolayer3++;
+/************************** LINK MODEL ***************/
 
-  /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being lost\n");
-    return;
-  }  
+/* With a bandwidth set, a packet sent from AorB waits for the packets
+   ahead of it on the link, takes its size over the bandwidth to send,
+   and then arrives after the propagation delay plus jitter, but never
+   before the packet ahead of it.  If queue packets are already waiting
+   behind the one being sent the new one is dropped. */
 
-  /* make a copy of the packet student just gave me since he/she may decide */
-  /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+/* the channel from AorB of the current flow */
+static struct channel *channel(int AorB)
+{
+  return &sim->chans[(sim->cfg.bottleneck ? 0 : 2 * sim->curflow) + AorB];
+}
+
+/* when a packet of size bytes sent from AorB now has been sent, or -1 if
+   there is no room for it */
+static float linksend(int AorB, int size)
+{
+  const struct linkconfig *link = &sim->cfg.link[AorB];
+  struct channel *ch = channel(AorB);
+  float start, done;
+  int cap = link->queue + 1;
+
+  if (link->queue > 0) {
+    while (ch->txcount > 0 && ch->txdone[ch->txfirst] <= sim->time) {
+      ch->txfirst = (ch->txfirst + 1) % cap;
+      ch->txcount--;
+    }
+    if (ch->txcount == cap)
+      return -1.0;
   }
-  mypktptr->seqnum = packet.seqnum;
-  mypktptr->acknum = packet.acknum;
-  mypktptr->checksum = packet.checksum;
-  for (i=0; i<20; i++)
-    mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
-    printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
-           mypktptr->acknum,  mypktptr->checksum);
-    for (i=0; i<20; i++)
-      printf("%c",mypktptr->payload[i]);
-    printf("\n");
+  start = ch->txfree > sim->time ? ch->txfree : sim->time;
+  done = start + size / link->bandwidth;
+  ch->txfree = done;
+  if (link->queue > 0) {
+    ch->txdone[(ch->txfirst + ch->txcount) % cap] = done;
+    ch->txcount++;
   }
+  return done;
+}
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+/* the random part of the delay of the packet being sent, as it was in
+   the replayed log if it is there */
+static double delaydraw(void)
+{
+  double x;
+
+  if (sim->replaying && (sim->replayed.flags & EVLOG_DELAY))
+    x = sim->replayed.value;
+  else
+    x = jimsrand(RNG_DELAY);
+  sim->send.flags |= EVLOG_DELAY;
+  sim->send.value = x;
+  return x;
+}
+
+static float linkdelay(int AorB)
+{
+  const struct linkconfig *link = &sim->cfg.link[AorB];
+
+  if (link->jitter == 0.0)
+    return link->propdelay;
+  if (link->jitterdist == JITTER_EXPONENTIAL)
+    return link->propdelay - link->jitter * log(1.0 - delaydraw());
+  return link->propdelay + link->jitter * delaydraw();
+}
+
+/* the next float after t, so that an arrival held back behind another
+   one comes strictly after it and the two cannot swap */
+static float justafter(float t)
+{
+  uint32_t bits;
+
+  memcpy(&bits, &t, sizeof(bits));
+  bits++;
+  memcpy(&t, &bits, sizeof(bits));
+  return t;
+}
+
+/********************** EVENT LOG ROUTINES ***********************/
+
+static void logevent(const struct event *evptr)
+{
+  struct evrecord rec;
+
+  rec.kind = EVLOG_EVENT;
+  rec.type = evptr->evtype;
+  rec.entity = evptr->eventity;
+  rec.flags = 0;
+  rec.time = evptr->evtime;
+  rec.seqnum = evptr->evtype == FROM_LAYER3 ? evptr->pkt.seqnum : -1;
+  rec.acknum = evptr->evtype == FROM_LAYER3 ? evptr->pkt.acknum : -1;
+  rec.value = 0.0;
+  evlog_write(sim->record, &rec);
+}
+
+/* the fate of the next packet AorB sends, from the replayed log;
+   returns 0 once the log has no more, and the channel draws again */
+static int replaynext(int AorB)
+{
+  while (evlog_read(sim->replay[AorB], &sim->replayed))
+    if (sim->replayed.kind == EVLOG_SEND && sim->replayed.entity == AorB)
+      return 1;
+  if (TRACEON(TRACE_CHANNEL, 1))
+    tprintf("          REPLAY: no more packets from %c in the log\n", "AB"[AorB]);
+  evlog_close(sim->replay[AorB]);
+  sim->replay[AorB] = NULL;
+  return 0;
+}
+
+/* record what happened to the packet being sent */
+static void logsend(int flags)
+{
+  if (sim->record == NULL)
+    return;
+  sim->send.flags |= flags;
+  evlog_write(sim->record, &sim->send);
+}
+
+/************************** TOLAYER3 ***************/
+void tolayer3(int AorB, struct pkt packet)
+/* A or B is sending to network  */
+{
+  tolayer3_ptr(AorB, &packet);
+}
+
+static struct event *transmit(int AorB, const struct pkt *packet);
+static void sendtolink(int AorB, const struct pkt *packet);
+
+void tolayer3_ptr(int AorB, const struct pkt *packet)
+{
+  struct event *evptr;
+
+  sim->ntolayer3++;
+  sim->nsent[AorB]++;
+
+  /* a replayed log decides instead of the random numbers while it lasts */
+  sim->replaying = sim->replay[AorB] != NULL && replaynext(AorB);
+  sim->send.kind = EVLOG_SEND;
+  sim->send.type = 0;
+  sim->send.entity = AorB;
+  sim->send.flags = 0;
+  sim->send.time = sim->time;
+  sim->send.seqnum = packet->seqnum;
+  sim->send.acknum = packet->acknum;
+  sim->send.value = 0.0;
+
+  /* simulate losses: */
+  if (sim->replaying ? (sim->replayed.flags & EVLOG_LOST) != 0 :
+      jimsrand(RNG_LOSS) < sim->cfg.lossprob && (!(AorB == B && sim->cfg.corruptdirection == A) && !(AorB == A && sim->cfg.corruptdirection == B))) {
+    sim->nlost++;
+    if (TRACEON(TRACE_CHANNEL, 1))    
+      tprintf("          TOLAYER3: packet being lost\n");
+    logsend(EVLOG_LOST);
+    return;
+  }  
+
+  if (sim->tolink != NULL)
+    sendtolink(AorB, packet);
+  else if ((evptr = transmit(AorB, packet)) != NULL)
+    insertevent(evptr);
+}
+
+/* the rest of the way through the channel of a packet that was not
+   lost: its arrival event, or NULL if the link queue had no room */
+static struct event *transmit(int AorB, const struct pkt *packet)
+{
+  struct pkt *mypktptr;
+  struct event *evptr;
+  struct channel *ch = channel(AorB);
+  float lastime, x, sent = 0.0;
+  int how;
+
+  /* wait for the link, if there is room in its queue */
+  if (sim->cfg.link[AorB].bandwidth > 0.0) {
+    sent = linksend(AorB, PKTSIZE(packet->length >= 0 && packet->length <= MAXPAYLOAD ? packet->length : MAXPAYLOAD));
+    if (sent < 0.0) {
+      sim->nqueuedrop++;
+      if (TRACEON(TRACE_CHANNEL, 1))
+        tprintf("          TOLAYER3: link queue full, packet dropped\n");
+      logsend(EVLOG_QUEUEDROP);
+      return NULL;
+    }
+  }
+
+  /* make a copy of the packet student just gave me since he/she may decide */
+  /* to do something with the packet after we return back to him/her. */
+  /* The copy is stored inline in the arrival event. */
+  evptr = allocevent();
+  mypktptr = &evptr->pkt;
+  if (packet->length >= 0 && packet->length <= MAXPAYLOAD)
+    memcpy(mypktptr, packet, PKTSIZE(packet->length));
+  else
+    *mypktptr = *packet;
+  if (TRACEON(TRACE_CHANNEL, 3))  {
+    tprintf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
+           mypktptr->acknum,  mypktptr->checksum);
+    tracebytes(mypktptr->payload, mypktptr->length < MAXPAYLOAD ? mypktptr->length : MAXPAYLOAD);
+    tprintf("\n");
+  }
+
+  /* the packet travels inside the event for its arrival at the other side */
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+     currently in the medium on their way to the destination.
+     Lost packets never enter the medium, and a packet that has already
+     been delivered has an arrival time no later than now.  With a
+     --byte-time the packet's transmission time is added on top.  The
+     link model, if set, replaces all of this. */
+  if (sim->cfg.link[AorB].bandwidth > 0.0) {
+    evptr->evtime = sent + linkdelay(AorB);
+    if (evptr->evtime <= ch->lastarrival)
+      evptr->evtime = justafter(ch->lastarrival);
+  }
+  else {
+    lastime = sim->time;
+    if (ch->lastarrival > lastime)
+      lastime = ch->lastarrival;
+    evptr->evtime =  lastime + 1 + 9*delaydraw();
+    if (sim->cfg.bytetime > 0.0)
+      evptr->evtime += sim->cfg.bytetime * PKTSIZE(mypktptr->length);
+  }
+  ch->lastarrival = evptr->evtime;
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
+  if (sim->replaying ? (sim->replayed.flags & EVLOG_CORRUPT) != 0 :
+      (jimsrand(RNG_CORRUPT) < sim->cfg.corruptprob)  && (!(AorB == B && sim->cfg.corruptdirection == A) && !(AorB == A && sim->cfg.corruptdirection == B))) {
+    sim->ncorrupt++;
+    if (sim->replaying)
+      how = EVLOG_HOW(sim->replayed.flags);
+    else if ( (x = jimsrand(RNG_CORRUPT)) < .75)
+      how = 0;
     else if (x < .875)
+      how = 1;
+    else
+      how = 2;
+    if (how == 0) {
+      if (mypktptr->length > 0)
+        mypktptr->payload[0]='Z';   /* corrupt payload */
+      else
+        mypktptr->length = 999999;  /* or the length of an empty one */
+    }
+    else if (how == 1)
       mypktptr->seqnum = 999999;
     else
       mypktptr->acknum = 999999;
-    if (TRACE>0)    
-      printf("          TOLAYER3: packet being corrupted\n");
+    sim->send.flags |= EVLOG_CORRUPT | EVLOG_SETHOW(how);
+    if (TRACEON(TRACE_CHANNEL, 1))    
+      tprintf("          TOLAYER3: packet being corrupted\n");
   }  
 
-  if (TRACE>2)  
-    printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  if (TRACEON(TRACE_CHANNEL, 3))  
+    tprintf("          TOLAYER3: scheduling arrival on other side\n");
+  logsend(0);
+  return evptr;
 } 
 
+/********************** LATENCY AND SAMPLING ***********************/
+
+/* note when a message for AorB came from layer 5 */
+static void pushborn(int AorB, float t)
+{
+  struct flow *fl = sim->fl;
+  float *ring;
+  int n, first;
+
+  if (fl->borncount[AorB] == fl->borncap[AorB]) {
+    n = fl->borncap[AorB] > 0 ? 2 * fl->borncap[AorB] : 64;
+    ring = malloc(n * sizeof(float));
+    if (ring == NULL) {
+      printf("memory allocation for message times failed.");
+      exit(EXIT_FAILURE);
+    }
+    /* unwrap the old ring into the start of the new one */
+    first = fl->bornfirst[AorB];
+    if (fl->born[AorB] != NULL) {
+      memcpy(ring, fl->born[AorB] + first, (fl->borncap[AorB] - first) * sizeof(float));
+      memcpy(ring + fl->borncap[AorB] - first, fl->born[AorB], first * sizeof(float));
+      free(fl->born[AorB]);
+    }
+    fl->born[AorB] = ring;
+    fl->bornfirst[AorB] = 0;
+    fl->borncap[AorB] = n;
+  }
+  fl->born[AorB][(fl->bornfirst[AorB] + fl->borncount[AorB]) % fl->borncap[AorB]] = t;
+  fl->borncount[AorB]++;
+}
+
+/* when the oldest message for AorB still on its way came from layer 5 */
+static float popborn(int AorB)
+{
+  struct flow *fl = sim->fl;
+  float t = fl->born[AorB][fl->bornfirst[AorB]];
+
+  if (++fl->bornfirst[AorB] == fl->borncap[AorB])
+    fl->bornfirst[AorB] = 0;
+  fl->borncount[AorB]--;
+  return t;
+}
+
+static void delivered(double latency)
+{
+  hist_add(sim->latency, latency);
+  sim->intervaln++;
+  sim->intervalsum += latency;
+  if (latency > sim->intervalmax)
+    sim->intervalmax = latency;
+}
+
+/* the protocol counters of all the flows of nsims simulators together,
+   added in the order of the flows */
+static void sumstats(struct protostats *sum, struct simulator **sims, int nsims)
+{
+  const struct protostats *s;
+  int f, k;
+
+  memset(sum, 0, sizeof(*sum));
+  for (k = 0; k < nsims; k++)
+    for (f = 0; f < sims[k]->nflows; f++) {
+      s = &sims[k]->flows[f].stats;
+      sum->window_full += s->window_full;
+      sum->total_ACKs_received += s->total_ACKs_received;
+      sum->packets_resent += s->packets_resent;
+      sum->new_ACKs += s->new_ACKs;
+      sum->packets_received += s->packets_received;
+      sum->fast_retransmits += s->fast_retransmits;
+      sum->messages_queued += s->messages_queued;
+      if (s->max_queue_depth > sum->max_queue_depth)
+        sum->max_queue_depth = s->max_queue_depth;
+      sum->queue_delay += s->queue_delay;
+      sum->acks_piggybacked += s->acks_piggybacked;
+      sum->cwnd_cuts += s->cwnd_cuts;
+    }
+}
+
+static int resends(void)
+{
+  int f, n = 0;
+
+  for (f = 0; f < sim->nflows; f++)
+    n += sim->flows[f].stats.packets_resent;
+  return n;
+}
+
+/* write the sample due at sim->nextsample: the state of both senders,
+   added up over the flows, then, and the rates over the interval up
+   to it */
+static void sample(void)
+{
+  struct srsnapshot snap[2], one;
+  double dt = sim->cfg.sampleinterval;
+  int i, f, resent = resends();
+
+  memset(snap, 0, sizeof(snap));
+  for (f = 0; f < sim->nflows; f++) {
+    sr_select(sim->flows[f].proto);
+    for (i = A; i <= B; i++) {
+      sr_snapshot(i, &one);
+      snap[i].window += one.window;
+      snap[i].inflight += one.inflight;
+      snap[i].queued += one.queued;
+      snap[i].cwnd += one.cwnd;
+    }
+  }
+  sr_select(sim->fl->proto);
+  fprintf(sim->samplefp, "%g", sim->nextsample);
+  for (i = A; i <= B; i++)
+    fprintf(sim->samplefp, ",%d,%d,%d,%g", snap[i].window, snap[i].inflight,
+            snap[i].queued, snap[i].cwnd);
+  fprintf(sim->samplefp, ",%g,%g,%g,%g,%g\n",
+          (sim->ntolayer3 - sim->lastsent) / dt,
+          (resent - sim->lastresent) / dt,
+          (sim->messages_delivered - sim->lastdelivered) / dt,
+          sim->intervaln > 0 ? sim->intervalsum / sim->intervaln : 0.0,
+          sim->intervalmax);
+  sim->lastsent = sim->ntolayer3;
+  sim->lastresent = resent;
+  sim->lastdelivered = sim->messages_delivered;
+  sim->intervaln = 0;
+  sim->intervalsum = 0.0;
+  sim->intervalmax = 0.0;
+  sim->nextsample += sim->cfg.sampleinterval;
+}
+
 void tolayer5(int AorB, char datasent[20])
 {
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
+  tolayer5_len(AorB, datasent, 20);
+}
+
+void tolayer5_len(int AorB, const char *datasent, int length)
+{
+  if (TRACEON(TRACE_CHANNEL, 3)) {
+    tprintf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
-      printf("A: ");
+      tprintf("A: ");
     else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
+      tprintf("B: ");
+    tracebytes(datasent, length);
+    tprintf("\n");
   }
-  messages_delivered++;
+  sim->messages_delivered++;
+  sim->bytes_delivered += length;
+  sim->fl->delivered++;
+  if (sim->fl->borncount[AorB] > 0)
+    delivered(sim->time - popborn(AorB));
 }
 
-int main(void)
+/********************** CHECKPOINTS ***********************/
+
+/* A checkpoint is the parameters of the run and then everything that
+   changes as it goes: the events waiting, the channel, the random
+   number streams, the counters and the protocol state, moved with
+   xfer.  It is in the layout of the build that wrote it, which the
+   header checks. */
+
+#define CKPTMAGIC "SRCKPT01"
+
+struct ckptheader {
+  char magic[8];
+  uint32_t sizes[4];              /* of the structures saved whole */
+};
+
+static void ckptheader(struct ckptheader *h)
+{
+  memset(h, 0, sizeof(*h));
+  memcpy(h->magic, CKPTMAGIC, sizeof(h->magic));
+  h->sizes[0] = sizeof(struct simconfig);
+  h->sizes[1] = sizeof(struct pkt);
+  h->sizes[2] = sizeof(struct protostats);
+  h->sizes[3] = sizeof(struct hist);
+}
+
+/* the parameters as saved: no file names, and no checkpoint to take */
+static void stripconfig(struct simconfig *cfg)
+{
+  cfg->record = NULL;
+  cfg->replay = NULL;
+  cfg->samples = NULL;
+  cfg->checkpoint = NULL;
+  cfg->checkpointat = -1.0;
+  cfg->checkpointevents = 0;
+  cfg->checkpointexit = 0;
+  cfg->restore = NULL;
+}
+
+/* open a checkpoint and read its parameters; NULL if it is not one */
+static FILE *openckpt(const char *path, struct simconfig *cfg)
+{
+  struct ckptheader want, h;
+  FILE *fp;
+
+  if ((fp = fopen(path, "rb")) == NULL) {
+    printf("cannot open checkpoint file %s\n", path);
+    return NULL;
+  }
+  ckptheader(&want);
+  if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(&h, &want, sizeof(h)) != 0 ||
+      fread(cfg, sizeof(*cfg), 1, fp) != 1) {
+    printf("%s is not a checkpoint written by this build\n", path);
+    fclose(fp);
+    return NULL;
+  }
+  stripconfig(cfg);
+  return fp;
+}
+
+static int loadconfig(struct simconfig *cfg, const char *path)
+{
+  FILE *fp;
+
+  if ((fp = openckpt(path, cfg)) == NULL)
+    return 0;
+  fclose(fp);
+  cfg->restore = strdup(path);
+  return cfg->restore != NULL;
+}
+
+/* whether the state of a run with parameters a fits one with b */
+static int samelayout(const struct simconfig *a, const struct simconfig *b)
+{
+  int i;
+
+  if (a->sr.windowsize != b->sr.windowsize || a->sr.backlog != b->sr.backlog ||
+      a->sr.bidirectional != b->sr.bidirectional || a->flows != b->flows ||
+      a->bottleneck != b->bottleneck)
+    return 0;
+  for (i = 0; i < 2; i++)
+    if ((a->link[i].bandwidth > 0.0) != (b->link[i].bandwidth > 0.0) ||
+        a->link[i].queue != b->link[i].queue)
+      return 0;
+  return 1;
+}
+
+/* move the state of the simulation on this thread to or from fp */
+static int simcheckpoint(FILE *fp, int saving)
+{
+  struct event *p;
+  struct channel *ch;
+  struct flow *fl;
+  int timer[2];
+  float t;
+  int i, j, f, n;
+
+  if (!XFER(sim->maxevcount) || !XFER(sim->nevents) || !XFER(sim->nsim) ||
+      !XFER(sim->time) || !XFER(sim->ntolayer3) || !XFER(sim->nsent) ||
+      !XFER(sim->nlost) || !XFER(sim->ncorrupt) || !XFER(sim->nqueuedrop) ||
+      !XFER(sim->messages_delivered) || !XFER(sim->bytes_delivered) ||
+      !xfer(fp, saving, sim->latency, sizeof(struct hist)) ||
+      !XFER(sim->nextsample) || !XFER(sim->lastsent) || !XFER(sim->lastresent) ||
+      !XFER(sim->lastdelivered) || !XFER(sim->intervaln) ||
+      !XFER(sim->intervalsum) || !XFER(sim->intervalmax))
+    return 0;
+  for (i = 0; i < sim->nchans; i++) {
+    ch = &sim->chans[i];
+    if (!XFER(ch->lastarrival) || !XFER(ch->txfree) || !XFER(ch->txfirst) ||
+        !XFER(ch->txcount) ||
+        (ch->txdone != NULL &&
+         !xfer(fp, saving, ch->txdone, (sim->cfg.link[i % 2].queue + 1) * sizeof(float))))
+      return 0;
+  }
+
+  for (f = 0; f < sim->nflows; f++) {
+    fl = &sim->flows[f];
+    setflow(f);
+    if (!XFER(fl->stats) || !XFER(fl->evseqnext) || !XFER(fl->rngstate) ||
+        !XFER(fl->nsim) || !XFER(fl->delivered) || !sr_checkpoint(fp, saving))
+      return 0;
+
+    /* the arrival times of the messages on their way, oldest first */
+    for (i = 0; i < 2; i++) {
+      n = fl->borncount[i];
+      if (!XFER(n))
+        return 0;
+      for (j = 0; j < n; j++) {
+        if (saving)
+          t = fl->born[i][(fl->bornfirst[i] + j) % fl->borncap[i]];
+        if (!XFER(t))
+          return 0;
+        if (!saving)
+          pushborn(i, t);
+      }
+    }
+  }
+
+  /* the events in heap order, which is still a heap when they are put
+     back in the same order; each keeps its flow and evseq for ties */
+  n = sim->evcount;
+  if (!XFER(n) || n < 0)
+    return 0;
+  for (i = 0; i < n; i++) {
+    p = saving ? sim->evheap[i] : allocevent();
+    if (!XFER(p->evtime) || !XFER(p->evtype) || !XFER(p->eventity) ||
+        !XFER(p->evflow) || !XFER(p->evseq) || !XFER(p->pkt) ||
+        p->evflow < 0 || p->evflow >= sim->nflows)
+      return 0;
+    if (!saving) {
+      growheap();
+      p->heappos = sim->evcount;
+      sim->evheap[sim->evcount++] = p;
+    }
+  }
+  for (f = 0; f < sim->nflows; f++) {
+    fl = &sim->flows[f];
+    for (i = 0; i < 2; i++)
+      timer[i] = fl->timers[i] != NULL ? fl->timers[i]->heappos : -1;
+    if (!XFER(timer) || timer[A] >= n || timer[B] >= n)
+      return 0;
+    if (!saving)
+      for (i = 0; i < 2; i++)
+        fl->timers[i] = timer[i] >= 0 ? sim->evheap[timer[i]] : NULL;
+  }
+  return 1;
+}
+
+/* whether the checkpoint is to be taken before the next event */
+static int checkpointdue(void)
+{
+  if (sim->evcount == 0)
+    return 0;
+  return (sim->cfg.checkpointat >= 0.0 && sim->evheap[0]->evtime > sim->cfg.checkpointat) ||
+         (sim->cfg.checkpointevents > 0 && sim->nevents >= sim->cfg.checkpointevents);
+}
+
+/* save the checkpoint; it is written next to the file and renamed over
+   it, so a run that dies while saving leaves any older one whole */
+static void savecheckpoint(void)
+{
+  const char *path = sim->cfg.checkpoint;
+  struct ckptheader h;
+  struct simconfig cfg = sim->cfg;
+  char *tmp;
+  FILE *fp;
+  int ok;
+
+  if ((tmp = malloc(strlen(path) + 5)) == NULL) {
+    printf("memory allocation for checkpoint failed.");
+    exit(EXIT_FAILURE);
+  }
+  sprintf(tmp, "%s.tmp", path);
+  if ((fp = fopen(tmp, "wb")) == NULL) {
+    printf("cannot open checkpoint file %s\n", tmp);
+    exit(EXIT_FAILURE);
+  }
+  ckptheader(&h);
+  stripconfig(&cfg);
+  ok = fwrite(&h, sizeof(h), 1, fp) == 1 && fwrite(&cfg, sizeof(cfg), 1, fp) == 1 &&
+       simcheckpoint(fp, 1);
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(tmp, path) != 0) {
+    printf("cannot write checkpoint file %s\n", path);
+    remove(tmp);
+    exit(EXIT_FAILURE);
+  }
+  free(tmp);
+}
+
+/* take the state of the simulation on this thread from a checkpoint */
+static void restorecheckpoint(void)
+{
+  const char *path = sim->cfg.restore;
+  struct simconfig saved;
+  double interval = sim->cfg.sampleinterval;
+  FILE *fp;
+
+  if ((fp = openckpt(path, &saved)) == NULL)
+    exit(EXIT_FAILURE);
+  if (!samelayout(&saved, &sim->cfg)) {
+    printf("a restored run can't change the window, backlog, direction, flows or link queues\n");
+    exit(EXIT_FAILURE);
+  }
+  if (!simcheckpoint(fp, 0) || fgetc(fp) != EOF) {
+    printf("checkpoint file %s is damaged\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(fp);
+
+  /* a new time series starts at the next multiple of the interval */
+  if (sim->nextsample <= sim->time || saved.sampleinterval != sim->cfg.sampleinterval) {
+    sim->nextsample = (floor(sim->time / interval) + 1) * interval;
+    sim->lastsent = sim->ntolayer3;
+    sim->lastresent = resends();
+    sim->lastdelivered = sim->messages_delivered;
+    sim->intervaln = 0;
+    sim->intervalsum = 0.0;
+    sim->intervalmax = 0.0;
+  }
+}
+
+/********************** RUNNING A SIMULATION ***********************/
+
+/* how evenly the flows of nsims simulators were served: Jain's index of
+   the messages each had delivered, 1 when all had the same and 1/flows
+   when one had all */
+static void fairness(struct simresult *res, struct simulator **sims, int nsims)
+{
+  double sum = 0.0, squares = 0.0;
+  int f, k, n;
+
+  res->nflows = 0;
+  res->flowmin = res->flowmax = sims[0]->flows[0].delivered;
+  for (k = 0; k < nsims; k++)
+    for (f = 0; f < sims[k]->nflows; f++) {
+      n = sims[k]->flows[f].delivered;
+      sum += n;
+      squares += (double)n * n;
+      if (n < res->flowmin)
+        res->flowmin = n;
+      if (n > res->flowmax)
+        res->flowmax = n;
+      res->nflows++;
+    }
+  res->fairness = squares > 0.0 ? sum * sum / (res->nflows * squares) : 1.0;
+}
+
+/* the results of nsims simulators that ran the flows of one run between
+   them, in the order of their flows; the latency histogram of the first
+   takes in those of the others */
+static void collect(struct simresult *res, struct simulator **sims, int nsims)
+{
+  const struct simulator *s;
+  struct hist *latency = sims[0]->latency;
+  int k;
+
+  memset(res, 0, sizeof(*res));
+  for (k = 0; k < nsims; k++) {
+    s = sims[k];
+    if (s->time > res->time)
+      res->time = s->time;
+    res->nsim += s->nsim;
+    res->ntolayer3 += s->ntolayer3;
+    res->nsent[A] += s->nsent[A];
+    res->nsent[B] += s->nsent[B];
+    res->nlost += s->nlost;
+    res->ncorrupt += s->ncorrupt;
+    res->nqueuedrop += s->nqueuedrop;
+    res->messages_delivered += s->messages_delivered;
+    res->bytes_delivered += s->bytes_delivered;
+    res->nevents += s->nevents;
+    res->maxevents += s->maxevcount;
+    res->evmemory += (long)s->nslabs * sizeof(struct evslab) +
+                     (long)s->evcapacity * sizeof(struct event *);
+    if (k > 0)
+      hist_merge(latency, s->latency);
+  }
+  res->latmean = hist_mean(latency);
+  res->latp50 = hist_percentile(latency, 0.5);
+  res->latp99 = hist_percentile(latency, 0.99);
+  res->latp999 = hist_percentile(latency, 0.999);
+  res->latmax = latency->max;
+  sumstats(&res->stats, sims, nsims);
+  fairness(res, sims, nsims);
+}
+
+/* handle an event taken off the heap */
+static void handleevent(struct event *eventptr)
 {
-  struct event *eventptr;
   struct msg  msg2give;
-  struct pkt  pkt2give;
    
   int i,j;
+  int dropped;
   
-  init();
-  A_init();
-  B_init();
+  if (TRACEON(TRACE_SCHEDULER, 2)) {
+    tprintf("\nEVENT time: %f,",eventptr->evtime);
+    tprintf("  type: %d",eventptr->evtype);
+    if (eventptr->evtype==0)
+      tprintf(", timerinterrupt  ");
+    else if (eventptr->evtype==1)
+      tprintf(", fromlayer5 ");
+    else
+      tprintf(", fromlayer3 ");
+    tprintf(" entity: %d",eventptr->eventity);
+    if (sim->cfg.flows > 1)
+      tprintf(" flow: %d",eventptr->evflow);
+    tprintf("\n");
+  }
+  setflow(eventptr->evflow - sim->flowbase);
+  while (sim->samplefp != NULL && eventptr->evtime > sim->nextsample)
+    sample();
+  sim->time = eventptr->evtime;        /* update time to next event time */
+  if (eventptr->evtype == FROM_LAYER5 ) {
+    if (sim->fl->nsim < sim->cfg.nsimmax) {
+      generate_next_arrival();   /* set up future arrival */
+      /* fill in msg to give with string of same letter */    
+      msg2give.length = sim->cfg.payload;
+      if (sim->cfg.payloadmin >= 0 && sim->cfg.payloadmin < sim->cfg.payload)
+        msg2give.length = sim->cfg.payloadmin +
+          (int)((sim->cfg.payload - sim->cfg.payloadmin + 1) * jimsrand(RNG_LENGTH));
+      j = sim->fl->nsim % 26; 
+      for (i=0; i<msg2give.length; i++)  
+        msg2give.data[i] = 97 + j;
+      if (TRACEON(TRACE_SCHEDULER, 3)) {
+        tprintf("          MAINLOOP: data given to student: ");
+        tracebytes(msg2give.data, msg2give.length);
+        tprintf("\n");
+      }
+      sim->nsim++;
+      sim->fl->nsim++;
+      dropped = sim->fl->stats.window_full;
+      if (eventptr->eventity == A) 
+        A_output_ptr(&msg2give);  
+      else
+        B_output_ptr(&msg2give);  
+      if (sim->fl->stats.window_full == dropped)
+        pushborn(eventptr->eventity == A ? B : A, sim->time);
+    }
+    else if (TRACEON(TRACE_SCHEDULER, 3))
+        tprintf("          FROM_LAYER5: no more messages to send: \n");
+  }
+  else if (eventptr->evtype ==  FROM_LAYER3) {
+    /* the packet is handed over where it is, in the event, which
+       stays allocated until the entity returns */
+    if (eventptr->eventity ==A)      /* deliver packet by calling */
+      A_input_ptr(&eventptr->pkt);  /* appropriate entity */
+    else
+      B_input_ptr(&eventptr->pkt);
+  }
+  else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+    sim->fl->timers[eventptr->eventity] = NULL;   /* timer has fired, so can be restarted */
+    if (eventptr->eventity == A) 
+      A_timerinterrupt();
+    else
+      B_timerinterrupt();
+  }
+  else  {
+    tprintf("INTERNAL PANIC: unknown event type \n");
+  }
+}
+
+static void runparallel(const struct simconfig *cfg, struct simresult *res);
+
+void runsim(const struct simconfig *cfg, struct simresult *res)
+{
+  struct event *eventptr;
+
+  if (cfg->parallel > 1 && cfg->flows > 1) {
+    runparallel(cfg, res);
+    return;
+  }
+  init(cfg, 0, cfg->flows, 1);
+  if (cfg->restore != NULL)
+    restorecheckpoint();
    
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
+    if (cfg->checkpoint != NULL && !sim->checkpointed && checkpointdue()) {
+      savecheckpoint();
+      sim->checkpointed = 1;
+      if (cfg->checkpointexit)
+        break;
+    }
+    eventptr = nextevent();       /* get next event to simulate */
     if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
-      printf("\nEVENT time: %f,",eventptr->evtime);
-      printf("  type: %d",eventptr->evtype);
-      if (eventptr->evtype==0)
-        printf(", timerinterrupt  ");
-      else if (eventptr->evtype==1)
-        printf(", fromlayer5 ");
-      else
-        printf(", fromlayer3 ");
-      printf(" entity: %d\n",eventptr->eventity);
+      break;
+    sim->nevents++;
+    if (sim->record != NULL)
+      logevent(eventptr);
+    handleevent(eventptr);
+    freeevent(eventptr);
+  }
+
+  if (cfg->checkpoint != NULL && !sim->checkpointed)
+    printf("the run ended before the checkpoint was due, so none was saved\n");
+
+  collect(res, &sim, 1);
+  cleanup();
+}
+
+/********************** PARALLEL RUNS ***********************/
+
+/* With --parallel the flows are split between worker threads, each of
+   which runs its share in a simulator of its own, with its own event
+   list.  A flow only ever schedules events of its own, so flows with
+   links of their own never wait for each other and each worker runs
+   straight to the end.
+
+   Through a --bottleneck the flows meet at the link.  What happens to a
+   packet past the loss draw, from the link queue to its arrival time
+   and corruption, is then done by the link, on the calling thread, with
+   the delay and corruption streams of the packet's flow, which nothing
+   else draws from.  No packet arrives sooner than the lookahead, the
+   least delay of the link, after it is sent, so the run goes in windows:
+   when the earliest event of any worker is at t, all of them can run
+   their events before t plus the lookahead, since nothing the link does
+   with the packets sent meanwhile arrives before then.  The packets go to
+   the link through a single producer, single consumer ring from each
+   worker, and the link takes them in the order a single thread would
+   have sent them, by time and then by flow, and hands their arrival
+   events back through a ring to each worker.
+
+   The results are those of the run on one thread: each flow draws the
+   same random numbers and sees its events in the same order.  Only the
+   peak_events reported differs, as the workers' event lists are added
+   up rather than seen at once. */
+
+#define RINGSIZE 4096           /* packets in each ring, a power of two */
+
+/* a packet between a worker and the link: sent at time by entity of
+   flow, or arriving then at entity */
+struct transfer {
+  float time;
+  int entity;
+  int flow;                       /* -1 ends what one side has for a window */
+  unsigned long seq;              /* evseq of its arrival event */
+  struct pkt pkt;
+};
+
+struct worker {
+  struct parallel *par;
+  int first, count;               /* the flows it runs */
+  struct simulator *sim;          /* its simulator, kept for the results */
+  struct spsc tolink, fromlink;
+  float next;                     /* the time of its earliest event, or INFINITY */
+  struct transfer *sent;          /* for the link, what it sent in the window... */
+  int nsent, sentcap, taken;
+  int sending;                    /* ...and whether it may send more */
+  pthread_t thread;
+};
+
+struct parallel {
+  const struct simconfig *cfg;
+  struct worker *workers;
+  int nworkers;
+  pthread_barrier_t barrier;
+  float until;                    /* the end of the window being run */
+  int done;
+};
+
+static void copypkt(struct pkt *to, const struct pkt *from)
+{
+  if (from->length >= 0 && from->length <= MAXPAYLOAD)
+    memcpy(to, from, PKTSIZE(from->length));
+  else
+    *to = *from;
+}
+
+static void put(struct spsc *q, const struct transfer *t)
+{
+  while (!spsc_push(q, t))
+    sched_yield();
+}
+
+static void get(struct spsc *q, struct transfer *t)
+{
+  while (!spsc_pop(q, t))
+    sched_yield();
+}
+
+/* hand a packet that was not lost to the link; its arrival event will
+   have the evseq it would have had if it was inserted now */
+static void sendtolink(int AorB, const struct pkt *packet)
+{
+  struct transfer t;
+
+  t.time = sim->time;
+  t.entity = AorB;
+  t.flow = sim->flowbase + sim->curflow;
+  t.seq = sim->fl->evseqnext++;
+  copypkt(&t.pkt, packet);
+  put(sim->tolink, &t);
+}
+
+/* the least time from sending a packet to its arrival */
+static float lookahead(const struct simconfig *cfg)
+{
+  float least = INFINITY, d;
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (cfg->link[i].bandwidth > 0.0)
+      d = cfg->link[i].propdelay + PKTSIZE(0) / cfg->link[i].bandwidth;
+    else
+      d = 1.0;
+    if (d < least)
+      least = d;
+  }
+  return least;
+}
+
+/* the end of the window from t.  It is kept a few floats short of t
+   plus the lookahead, so that rounding the arrival times can't put one
+   inside it, but always takes in the events at t. */
+static float windowend(float t, float ahead)
+{
+  float end;
+
+  if (isinf(ahead))
+    return INFINITY;
+  end = t + ahead;
+  end -= 4 * (nextafterf(end, INFINITY) - end);
+  return end > t ? end : justafter(t);
+}
+
+static void *runworker(void *arg)
+{
+  struct worker *w = arg;
+  struct parallel *par = w->par;
+  struct event *eventptr;
+  struct transfer t;
+
+  init(par->cfg, w->first, w->count, 1);
+  if (par->cfg->bottleneck)
+    sim->tolink = &w->tolink;
+  for (;;) {
+    w->next = sim->evcount > 0 ? sim->evheap[0]->evtime : INFINITY;
+    pthread_barrier_wait(&par->barrier);
+    pthread_barrier_wait(&par->barrier);
+    if (par->done)
+      break;
+    while (sim->evcount > 0 && sim->evheap[0]->evtime < par->until) {
+      eventptr = nextevent();
+      sim->nevents++;
+      handleevent(eventptr);
+      freeevent(eventptr);
     }
-    time = eventptr->evtime;        /* update time to next event time */
-    if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
+    t.flow = -1;
+    put(&w->tolink, &t);
+
+    /* the arrivals of the packets the link took in the window */
+    for (get(&w->fromlink, &t); t.flow >= 0; get(&w->fromlink, &t)) {
+      eventptr = allocevent();
+      eventptr->evtime = t.time;
+      eventptr->evtype = FROM_LAYER3;
+      eventptr->eventity = t.entity;
+      eventptr->evflow = t.flow;
+      eventptr->evseq = t.seq;
+      copypkt(&eventptr->pkt, &t.pkt);
+      pushevent(eventptr);
+    }
+  }
+  w->sim = sim;
+  return NULL;
+}
+
+/* the link's part of a window: gather what every worker sent until all
+   have finished the window, then put the packets through the link in
+   the order of their sending and give the arrivals to their workers */
+static void runlink(struct parallel *par)
+{
+  struct worker *w, *first;
+  struct transfer t;
+  struct event *evptr;
+  int i, open = par->nworkers, progress;
+
+  for (i = 0; i < par->nworkers; i++) {
+    par->workers[i].nsent = 0;
+    par->workers[i].taken = 0;
+    par->workers[i].sending = 1;
+  }
+  while (open > 0) {
+    progress = 0;
+    for (i = 0; i < par->nworkers; i++) {
+      w = &par->workers[i];
+      while (w->sending && spsc_pop(&w->tolink, &t)) {
+        progress = 1;
+        if (t.flow < 0) {
+          w->sending = 0;
+          open--;
+          break;
+        }
+        if (w->nsent == w->sentcap) {
+          w->sentcap = w->sentcap ? 2 * w->sentcap : RINGSIZE;
+          w->sent = realloc(w->sent, w->sentcap * sizeof(struct transfer));
+          if (w->sent == NULL) {
+            printf("memory allocation for the link failed.");
+            exit(EXIT_FAILURE);
+          }
         }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+        w->sent[w->nsent++] = t;
       }
-      else if (TRACE > 2)
-          printf("          FROM_LAYER5: no more messages to send: \n");
     }
-    else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
-      else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+    if (!progress)
+      sched_yield();
+  }
+
+  /* each worker sent in order of time and flow, so merge them */
+  for (;;) {
+    first = NULL;
+    for (i = 0; i < par->nworkers; i++) {
+      w = &par->workers[i];
+      if (w->taken < w->nsent &&
+          (first == NULL || w->sent[w->taken].time < first->sent[first->taken].time ||
+           (w->sent[w->taken].time == first->sent[first->taken].time &&
+            w->sent[w->taken].flow < first->sent[first->taken].flow)))
+        first = w;
     }
-    else if (eventptr->evtype ==  TIMER_INTERRUPT) {
-      if (eventptr->eventity == A) 
-        A_timerinterrupt();
-      else
-        B_timerinterrupt();
+    if (first == NULL)
+      break;
+    t = first->sent[first->taken++];
+    sim->time = t.time;
+    setflow(t.flow);
+    if ((evptr = transmit(t.entity, &t.pkt)) == NULL)
+      continue;
+    if (evptr->evtime < par->until) {
+      printf("a packet sent at %f arrived at %f, inside the window; the link delay\n"
+             "is too short for a parallel run at this time scale\n", t.time, evptr->evtime);
+      exit(EXIT_FAILURE);
     }
-    else  {
-      printf("INTERNAL PANIC: unknown event type \n");
+    t.time = evptr->evtime;
+    t.entity = evptr->eventity;
+    copypkt(&t.pkt, &evptr->pkt);
+    freeevent(evptr);
+    put(&first->fromlink, &t);
+  }
+  t.flow = -1;
+  for (i = 0; i < par->nworkers; i++)
+    put(&par->workers[i].fromlink, &t);
+}
+
+static void runparallel(const struct simconfig *cfg, struct simresult *res)
+{
+  struct parallel par;
+  struct simulator **sims, *link = NULL;
+  struct worker *w;
+  float ahead, t;
+  int i, n = cfg->parallel < cfg->flows ? cfg->parallel : cfg->flows;
+
+  par.cfg = cfg;
+  par.nworkers = n;
+  par.done = 0;
+  par.workers = calloc(n, sizeof(struct worker));
+  sims = malloc(n * sizeof(struct simulator *));
+  if (par.workers == NULL || sims == NULL) {
+    printf("memory allocation for workers failed.");
+    exit(EXIT_FAILURE);
+  }
+  pthread_barrier_init(&par.barrier, NULL, n + 1);
+  if (cfg->bottleneck) {
+    init(cfg, 0, cfg->flows, 0);
+    link = sim;
+  }
+  ahead = cfg->bottleneck ? lookahead(cfg) : INFINITY;
+  for (i = 0; i < n; i++) {
+    w = &par.workers[i];
+    w->par = &par;
+    w->first = (int)((long long)cfg->flows * i / n);
+    w->count = (int)((long long)cfg->flows * (i + 1) / n) - w->first;
+    if (!spsc_init(&w->tolink, sizeof(struct transfer), RINGSIZE) ||
+        !spsc_init(&w->fromlink, sizeof(struct transfer), RINGSIZE)) {
+      printf("memory allocation for workers failed.");
+      exit(EXIT_FAILURE);
     }
-    free(eventptr);
+    if (pthread_create(&w->thread, NULL, runworker, w) != 0) {
+      printf("cannot start worker threads\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (;;) {
+    pthread_barrier_wait(&par.barrier);    /* the workers have said when they are next */
+    t = INFINITY;
+    for (i = 0; i < n; i++)
+      if (par.workers[i].next < t)
+        t = par.workers[i].next;
+    if (!(par.done = isinf(t)))
+      par.until = windowend(t, ahead);
+    pthread_barrier_wait(&par.barrier);
+    if (par.done)
+      break;
+    runlink(&par);
   }
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  for (i = 0; i < n; i++) {
+    w = &par.workers[i];
+    pthread_join(w->thread, NULL);
+    sims[i] = w->sim;
+    spsc_free(&w->tolink);
+    spsc_free(&w->fromlink);
+    free(w->sent);
+  }
+  collect(res, sims, n);
+  if (link != NULL) {
+    res->ncorrupt += link->ncorrupt;
+    res->nqueuedrop += link->nqueuedrop;
+    res->evmemory += (long)link->nslabs * sizeof(struct evslab);
+    sim = link;
+    cleanup();
+  }
+  for (i = 0; i < n; i++) {
+    sim = sims[i];
+    cleanup();
+  }
+  pthread_barrier_destroy(&par.barrier);
+  free(par.workers);
+  free(sims);
+}
+
+/********************** STATISTICS REPORT ***********************/
+
+static void printstats(const struct simconfig *cfg, const struct simresult *res)
+{
+  /* in both directions the protocol counters add up the two sides */
+  const char *sender = cfg->sr.bidirectional ? "A and B" : "A";
+  const char *receiver = cfg->sr.bidirectional ? "A and B" : "B";
+
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",res->time,res->nsim);
+  printf("number of messages dropped due to full window:  %d \n", res->stats.window_full);
+  if (res->stats.messages_queued > 0)
+    printf("number of messages queued for a full window:  %d (at most %d at once, waiting %f on average)\n",
+           res->stats.messages_queued, res->stats.max_queue_depth,
+           res->stats.queue_delay / res->stats.messages_queued);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at %s:  %d \n", sender, res->stats.new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("number of packet resends by %s:  %d \n", sender, res->stats.packets_resent);
+  if (res->stats.fast_retransmits > 0)
+    printf("(of which fast retransmits after a NACK:  %d)\n", res->stats.fast_retransmits);
+  if (res->stats.cwnd_cuts > 0)
+    printf("number of congestion window cuts:  %d \n", res->stats.cwnd_cuts);
+  printf("number of correct packets received at %s:  %d \n", receiver, res->stats.packets_received);
+  if (res->stats.acks_piggybacked > 0)
+    printf("number of ACKs sent on data packets:  %d \n", res->stats.acks_piggybacked);
+  if (res->nqueuedrop > 0)
+    printf("number of packets dropped by a full link queue:  %d \n", res->nqueuedrop);
+  printf("number of messages delivered to application:  %d \n", res->messages_delivered);
+  if (res->nflows > 1)
+    printf("messages delivered per flow over %d flows:  %d to %d, Jain's fairness index %f \n",
+           res->nflows, res->flowmin, res->flowmax, res->fairness);
+  if (res->messages_delivered > 0)
+    printf("latency from layer 5 to delivery:  mean %f, p50 %f, p99 %f, p99.9 %f, max %f \n",
+           res->latmean, res->latp50, res->latp99, res->latp999, res->latmax);
+}
+
+/* a float parameter as the decimal value it was most likely given as,
+   so that 0.1 is reported as 0.1 rather than 0.100000001 */
+static double shortest(float x)
+{
+  char buf[32];
+
+  sprintf(buf, "%g", x);
+  return atof(buf);
+}
+
+/* write the parameters and every counter as one JSON object or one CSV
+   row, so that sweep tooling can collect runs in a single results file:
+   - throughput is messages delivered per simulated time unit, and
+     byte throughput the bytes of data in them per time unit
+   - delivery ratio is messages delivered per packet sent into layer 3
+   - retransmission ratio is the resends over all packets the senders
+     sent: A's alone, or A's and B's with --bidirectional=1, since the
+     protocol counters then add up both sides */
+void writeresult(FILE *fp, int format, int header,
+                 const struct simconfig *cfg, const struct simresult *res)
+{
+  static const char *names[] = {
+    "msgs", "loss", "corrupt", "direction", "lambda", "seed", "window",
+    "payload", "payload_min", "byte_time",
+    "bandwidth_ab", "prop_delay_ab", "jitter_ab", "jitter_dist_ab", "queue_ab",
+    "bandwidth_ba", "prop_delay_ba", "jitter_ba", "jitter_dist_ba", "queue_ba",
+    "adaptive_rto", "timeout", "nack", "backlog", "checksum",
+    "bidirectional", "ack_delay", "ack_mode", "ack_every",
+    "congestion", "flows", "bottleneck",
+    "sim_time", "msgs_attempted", "window_full", "messages_queued",
+    "max_queue_depth", "mean_queue_delay", "total_acks_received",
+    "new_acks", "packets_resent", "fast_retransmits", "cwnd_cuts", "packets_received",
+    "acks_piggybacked", "messages_delivered", "bytes_delivered", "ntolayer3",
+    "nsent_a", "nsent_b", "nlost", "ncorrupt", "nqueuedrop", "events", "peak_events",
+    "latency_mean", "latency_p50", "latency_p99", "latency_p999", "latency_max",
+    "flow_min_delivered", "flow_max_delivered", "fairness",
+    "throughput", "byte_throughput", "delivery_ratio", "retransmission_ratio"
+  };
+
+  double values[sizeof(names) / sizeof(names[0])];
+  int nvalues = sizeof(names) / sizeof(names[0]);
+  int i, n, sent;
+
+  n = 0;
+  values[n++] = cfg->nsimmax;
+  values[n++] = shortest(cfg->lossprob);
+  values[n++] = shortest(cfg->corruptprob);
+  values[n++] = cfg->corruptdirection;
+  values[n++] = shortest(cfg->lambda);
+  values[n++] = cfg->seed;
+  values[n++] = cfg->sr.windowsize;
+  values[n++] = cfg->payload;
+  values[n++] = cfg->payloadmin >= 0 && cfg->payloadmin < cfg->payload ? cfg->payloadmin : cfg->payload;
+  values[n++] = shortest(cfg->bytetime);
+  for (i = 0; i < 2; i++) {
+    values[n++] = shortest(cfg->link[i].bandwidth);
+    values[n++] = shortest(cfg->link[i].propdelay);
+    values[n++] = shortest(cfg->link[i].jitter);
+    values[n++] = cfg->link[i].jitterdist;
+    values[n++] = cfg->link[i].queue;
+  }
+  values[n++] = cfg->sr.adaptive;
+  values[n++] = shortest(cfg->sr.timeout);
+  values[n++] = cfg->sr.nack;
+  values[n++] = cfg->sr.backlog;
+  values[n++] = cfg->sr.checksum;
+  values[n++] = cfg->sr.bidirectional;
+  values[n++] = shortest(cfg->sr.ackdelay);
+  values[n++] = cfg->sr.ackmode;
+  values[n++] = cfg->sr.ackevery;
+  values[n++] = cfg->sr.congestion;
+  values[n++] = cfg->flows;
+  values[n++] = cfg->bottleneck;
+  values[n++] = res->time;
+  values[n++] = res->nsim;
+  values[n++] = res->stats.window_full;
+  values[n++] = res->stats.messages_queued;
+  values[n++] = res->stats.max_queue_depth;
+  values[n++] = res->stats.messages_queued > 0 ? res->stats.queue_delay / res->stats.messages_queued : 0.0;
+  values[n++] = res->stats.total_ACKs_received;
+  values[n++] = res->stats.new_ACKs;
+  values[n++] = res->stats.packets_resent;
+  values[n++] = res->stats.fast_retransmits;
+  values[n++] = res->stats.cwnd_cuts;
+  values[n++] = res->stats.packets_received;
+  values[n++] = res->stats.acks_piggybacked;
+  values[n++] = res->messages_delivered;
+  values[n++] = res->bytes_delivered;
+  values[n++] = res->ntolayer3;
+  values[n++] = res->nsent[A];
+  values[n++] = res->nsent[B];
+  values[n++] = res->nlost;
+  values[n++] = res->ncorrupt;
+  values[n++] = res->nqueuedrop;
+  values[n++] = res->nevents;
+  values[n++] = res->maxevents;
+  values[n++] = res->latmean;
+  values[n++] = res->latp50;
+  values[n++] = res->latp99;
+  values[n++] = res->latp999;
+  values[n++] = res->latmax;
+  values[n++] = res->flowmin;
+  values[n++] = res->flowmax;
+  values[n++] = res->fairness;
+  values[n++] = res->time > 0.0 ? res->messages_delivered / res->time : 0.0;
+  values[n++] = res->time > 0.0 ? res->bytes_delivered / res->time : 0.0;
+  values[n++] = res->ntolayer3 > 0 ? (double)res->messages_delivered / res->ntolayer3 : 0.0;
+  sent = res->nsent[A] + (cfg->sr.bidirectional ? res->nsent[B] : 0);
+  values[n++] = sent > 0 ? (double)res->stats.packets_resent / sent : 0.0;
+
+  if (format == STATS_JSON) {
+    fprintf(fp, "{");
+    for (i = 0; i < nvalues; i++)
+      fprintf(fp, "%s\"%s\": %.10g", i ? ", " : "", names[i], values[i]);
+    fprintf(fp, "}\n");
+  }
+  else {
+    if (header) {
+      for (i = 0; i < nvalues; i++)
+        fprintf(fp, "%s%s", i ? "," : "", names[i]);
+      fprintf(fp, "\n");
+    }
+    for (i = 0; i < nvalues; i++)
+      fprintf(fp, "%s%.10g", i ? "," : "", values[i]);
+    fprintf(fp, "\n");
+  }
+}
+
+/* open the statistics file for appending, or use stdout; *header is set
+   when a csv report needs to start with a header row */
+static FILE *openstats(int *header)
+{
+  FILE *fp;
+
+  *header = 1;
+  if (statsfile == NULL)
+    return stdout;
+  fp = fopen(statsfile, "a");
+  if (fp == NULL) {
+    printf("cannot open statistics file %s\n", statsfile);
+    exit(EXIT_FAILURE);
+  }
+  fseek(fp, 0, SEEK_END);
+  *header = ftell(fp) <= 0;
+  return fp;
+}
+
+int main(int argc, char **argv)
+{
+  struct simconfig cfg;
+  struct simresult res;
+  FILE *fp;
+  int header;
+  int ok;
+
+  readparams(argc, argv, &cfg);
+
+  if (decodefile != NULL)
+    return evlog_decode(decodefile, stdout) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if ((sweepgrid != NULL || benchscale > 0.0) && (cfg.record != NULL || cfg.replay != NULL)) {
+    printf("an event log can't be recorded or replayed in a sweep or benchmark\n");
+    return EXIT_FAILURE;
+  }
+  if ((sweepgrid != NULL || benchscale > 0.0) && cfg.samples != NULL) {
+    printf("samples can't be written in a sweep or benchmark\n");
+    free(cfg.samples);
+    return EXIT_FAILURE;
+  }
+  if (cfg.flows > 1 && (cfg.record != NULL || cfg.replay != NULL)) {
+    printf("an event log can only be recorded or replayed with one flow\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.checkpoint != NULL &&
+      (sweepgrid != NULL || benchscale > 0.0 || cfg.record != NULL || cfg.replay != NULL)) {
+    printf("a checkpoint can't be saved in a sweep, a benchmark or with an event log\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.checkpoint != NULL && cfg.checkpointat < 0.0 && cfg.checkpointevents <= 0) {
+    printf("--checkpoint needs --checkpoint-at or --checkpoint-events\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.restore != NULL && (benchscale > 0.0 || cfg.record != NULL || cfg.replay != NULL)) {
+    printf("a checkpoint can't be restored in a benchmark or with an event log\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.parallel != 1 && sweepgrid != NULL) {
+    printf("--parallel can't be used in a sweep, which runs its points on --threads\n");
+    return EXIT_FAILURE;
+  }
+  if (cfg.parallel != 1 && (cfg.trace > 0 || cfg.samples != NULL ||
+                            cfg.checkpoint != NULL || cfg.restore != NULL)) {
+    printf("a parallel run can't trace, write samples or save or restore a checkpoint\n");
+    free(cfg.samples);
+    return EXIT_FAILURE;
+  }
+  if (cfg.parallel == 0)
+    cfg.parallel = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  if (benchscale > 0.0) {
+    if (statsformat == STATS_TEXT)
+      statsformat = STATS_CSV;
+    fp = openstats(&header);
+    ok = runbench(&cfg, benchscale, fp, statsformat, header);
+    if (fp != stdout)
+      fclose(fp);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (sweepgrid != NULL) {
+    if (statsformat == STATS_TEXT)
+      statsformat = STATS_CSV;
+    if (nthreads == 0)
+      nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    fp = openstats(&header);
+    ok = runsweep(&cfg, sweepgrid, nthreads, fp, statsformat, header);
+    if (fp != stdout)
+      fclose(fp);
+    free(cfg.restore);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (cfg.trace > 0)
+    trace_start();
+  runsim(&cfg, &res);
+  trace_stop();
+
+  if (statsformat == STATS_TEXT || statsfile != NULL)
+    printstats(&cfg, &res);
+  if (statsformat != STATS_TEXT) {
+    fp = openstats(&header);
+    writeresult(fp, statsformat, header, &cfg, &res);
+    if (fp != stdout)
+      fclose(fp);
+  }
+  free(cfg.record);
+  free(cfg.replay);
+  free(cfg.samples);
+  free(cfg.checkpoint);
+  free(cfg.restore);
   return EXIT_SUCCESS;
 }
@@ -1,20 +1,54 @@
-extern int TRACE;
+extern _Thread_local int TRACE;
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* TRACE_MAX is the highest trace level compiled into the simulator and
+   the protocol.  Tracing code above it is dead and removed by the
+   compiler, so building with -DTRACE_MAX=0 gives a build whose hot path
+   carries no trace checks or format strings at all. */
+#ifndef TRACE_MAX
+#define TRACE_MAX 4
+#endif
+#define TRACING(level) (TRACE_MAX >= (level) && TRACE >= (level))
+
+/* statistics updated by GBN.  The emulator points stats at the counters
+   of the simulation running on the current thread. */
+struct protostats {
+  int window_full;          /* count of the number of messages dropped due to full window */
+  int total_ACKs_received;
+  int packets_resent;       /* count of the number of packets resent  */
+  int new_ACKs;             /* count of the number of acks correctly received */
+  int packets_received;     /* count of the packets received by receiver */
+  int fast_retransmits;     /* resends triggered by a NACK rather than a timeout */
+  int messages_queued;      /* messages sent after waiting in the backlog for the window */
+  int max_queue_depth;      /* the most messages waiting at once */
+  double queue_delay;       /* the total time they waited */
+  int acks_piggybacked;     /* ACKs that were sent on a data packet */
+  int cwnd_cuts;            /* times the congestion window was cut */
+};
+
+extern _Thread_local struct protostats *stats;
 
 #define   A    0
 #define   B    1
 
+/* MAXPAYLOAD is the largest message the simulator can carry, fixed at
+   build time because messages and packets hold their data inline; build
+   with e.g. -DMAXPAYLOAD=9000 for jumbo-frame sized messages.  The size
+   of the messages actually sent is chosen with --payload at run time.
+   Only the length in use is copied, so a large MAXPAYLOAD costs memory
+   but little time. */
+#ifndef MAXPAYLOAD
+#define MAXPAYLOAD 20
+#endif
+#if MAXPAYLOAD < 20
+#error "MAXPAYLOAD must be at least the original 20 bytes"
+#endif
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
 struct msg {
-  char data[20];
+  int length;                 /* number of bytes of data in use */
+  char data[MAXPAYLOAD];
 };
 
 /* a packet is the data unit passed from layer 4 (students code) to layer */
@@ -24,17 +58,29 @@ struct pkt {
   int seqnum;
   int acknum;
   int checksum;
-  char payload[20];
+  int length;                 /* number of bytes of payload in use */
+  char payload[MAXPAYLOAD];
 };
 
+/* bytes of a packet up to the end of its payload */
+#define PKTSIZE(length) (offsetof(struct pkt, payload) + (length))
+
 /* send to A or B (int), packet to send */
 extern void tolayer3(int, struct pkt);  
+/* the same, with the packet passed by pointer; only the copy that
+   travels in the arrival event is made */
+extern void tolayer3_ptr(int, const struct pkt *);
 
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
+/* the same for a message of any length */
+extern void tolayer5_len(int, const char *, int);
 
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
 /* stop timer at A or B (int) */
 extern void stoptimer(int);
+
+/* current simulated time */
+extern float currenttime(void);
@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "evlog.h"
+
+/* ******************************************************************
+   Binary event log.  Records go through a buffer of our own so that
+   logging an event costs a few stores, and the disk sees large writes.
+   *******************************************************************/
+
+#define EVLOGBUF   65536
+#define EVLOGMAGIC "SREVLOG1"
+#define EVLOGORDER 0x01020304u  /* tells the byte order of the writer */
+
+#define EVENTSIZE  16
+#define SENDSIZE   24
+
+struct evlog {
+  FILE *fp;
+  int writing;
+  size_t n;                       /* bytes in buf */
+  size_t pos;                     /* next byte to read */
+  unsigned char buf[EVLOGBUF];
+};
+
+struct evlog *evlog_open(const char *path, int writing)
+{
+  struct evlog *log;
+  char magic[8];
+  uint32_t order = EVLOGORDER;
+
+  log = malloc(sizeof(struct evlog));
+  if (log == NULL) {
+    printf("memory allocation for event log failed.\n");
+    return NULL;
+  }
+  log->writing = writing;
+  log->n = 0;
+  log->pos = 0;
+  log->fp = fopen(path, writing ? "wb" : "rb");
+  if (log->fp == NULL) {
+    printf("cannot open event log %s\n", path);
+    free(log);
+    return NULL;
+  }
+  if (writing) {
+    memcpy(log->buf, EVLOGMAGIC, 8);
+    memcpy(log->buf + 8, &order, 4);
+    log->n = 12;
+    return log;
+  }
+  if (fread(magic, 1, 8, log->fp) != 8 || memcmp(magic, EVLOGMAGIC, 8) != 0 ||
+      fread(&order, 4, 1, log->fp) != 1) {
+    printf("%s is not an event log\n", path);
+    evlog_close(log);
+    return NULL;
+  }
+  if (order != EVLOGORDER) {
+    printf("event log %s was written on a machine of another byte order\n", path);
+    evlog_close(log);
+    return NULL;
+  }
+  return log;
+}
+
+static void flushlog(struct evlog *log)
+{
+  if (log->n > 0 && fwrite(log->buf, 1, log->n, log->fp) != log->n) {
+    printf("writing the event log failed\n");
+    exit(EXIT_FAILURE);
+  }
+  log->n = 0;
+}
+
+void evlog_write(struct evlog *log, const struct evrecord *rec)
+{
+  unsigned char *p;
+  int32_t i;
+  size_t size = rec->kind == EVLOG_SEND ? SENDSIZE : EVENTSIZE;
+
+  if (log->n + size > EVLOGBUF)
+    flushlog(log);
+  p = log->buf + log->n;
+  p[0] = (unsigned char)rec->kind;
+  p[1] = (unsigned char)rec->type;
+  p[2] = (unsigned char)rec->entity;
+  p[3] = (unsigned char)rec->flags;
+  memcpy(p + 4, &rec->time, 4);
+  i = rec->seqnum;
+  memcpy(p + 8, &i, 4);
+  i = rec->acknum;
+  memcpy(p + 12, &i, 4);
+  if (rec->kind == EVLOG_SEND)
+    memcpy(p + 16, &rec->value, 8);
+  log->n += size;
+}
+
+/* make at least size bytes readable, unless the log ends first */
+static int fill(struct evlog *log, size_t size)
+{
+  if (log->n - log->pos >= size)
+    return 1;
+  memmove(log->buf, log->buf + log->pos, log->n - log->pos);
+  log->n -= log->pos;
+  log->pos = 0;
+  log->n += fread(log->buf + log->n, 1, EVLOGBUF - log->n, log->fp);
+  return log->n >= size;
+}
+
+int evlog_read(struct evlog *log, struct evrecord *rec)
+{
+  const unsigned char *p;
+  int32_t i;
+  size_t size;
+
+  if (!fill(log, EVENTSIZE))
+    return 0;
+  size = log->buf[log->pos] == EVLOG_SEND ? SENDSIZE : EVENTSIZE;
+  if (!fill(log, size))
+    return 0;
+  p = log->buf + log->pos;
+  rec->kind = p[0];
+  rec->type = p[1];
+  rec->entity = p[2];
+  rec->flags = p[3];
+  memcpy(&rec->time, p + 4, 4);
+  memcpy(&i, p + 8, 4);
+  rec->seqnum = i;
+  memcpy(&i, p + 12, 4);
+  rec->acknum = i;
+  rec->value = 0.0;
+  if (rec->kind == EVLOG_SEND)
+    memcpy(&rec->value, p + 16, 8);
+  log->pos += size;
+  return 1;
+}
+
+void evlog_close(struct evlog *log)
+{
+  if (log->writing)
+    flushlog(log);
+  fclose(log->fp);
+  free(log);
+}
+
+int evlog_decode(const char *path, FILE *out)
+{
+  static const char *types[] = { "timerinterrupt", "fromlayer5", "fromlayer3" };
+  static const char *hows[] = { "payload", "seqnum", "acknum", "?" };
+  struct evlog *log;
+  struct evrecord rec;
+
+  if ((log = evlog_open(path, 0)) == NULL)
+    return 0;
+  while (evlog_read(log, &rec)) {
+    if (rec.kind == EVLOG_EVENT) {
+      fprintf(out, "%f  EVENT %-14s %c", rec.time,
+              rec.type <= 2 ? types[rec.type] : "?", "AB"[rec.entity & 1]);
+      if (rec.type == 2)
+        fprintf(out, "  seq %d ack %d", rec.seqnum, rec.acknum);
+      fprintf(out, "\n");
+      continue;
+    }
+    fprintf(out, "%f  SEND  %c  seq %d ack %d", rec.time, "AB"[rec.entity & 1],
+            rec.seqnum, rec.acknum);
+    if (rec.flags & EVLOG_LOST)
+      fprintf(out, "  lost");
+    if (rec.flags & EVLOG_QUEUEDROP)
+      fprintf(out, "  queue full");
+    if (rec.flags & EVLOG_DELAY)
+      fprintf(out, "  delay draw %.6f", rec.value);
+    if (rec.flags & EVLOG_CORRUPT)
+      fprintf(out, "  corrupt %s", hows[EVLOG_HOW(rec.flags)]);
+    fprintf(out, "\n");
+  }
+  evlog_close(log);
+  return 1;
+}
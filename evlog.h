@@ -0,0 +1,47 @@
+/* needs stdio.h and stdint.h */
+
+/* Binary event log.  With --record a run writes every event it takes
+   off the event list and every decision the channel makes about a
+   packet into a compact log, much cheaper than a trace.  --replay feeds
+   the channel decisions of a log back into a run instead of drawing
+   them, each side's n-th packet meeting the fate of its n-th packet in
+   the log, so protocol variants can be compared on the same channel,
+   and --decode prints a log as text.
+
+   A log is a header followed by records in the byte order of the
+   machine that wrote it: an event record is 16 bytes, a send record
+   adds the delay draw and is 24. */
+
+#define EVLOG_EVENT 0           /* an event was taken off the event list */
+#define EVLOG_SEND  1           /* a packet was given to layer 3 */
+
+/* flags of a send record */
+#define EVLOG_LOST      0x01    /* lost by the channel */
+#define EVLOG_QUEUEDROP 0x02    /* dropped by a full link queue */
+#define EVLOG_DELAY     0x04    /* value is the random part of its delay */
+#define EVLOG_CORRUPT   0x08    /* corrupted, in the way given by... */
+#define EVLOG_HOW(flags) (((flags) >> 4) & 3)  /* 0 payload, 1 seqnum, 2 acknum */
+#define EVLOG_SETHOW(how) ((how) << 4)
+
+struct evrecord {
+  int kind;               /* EVLOG_EVENT or EVLOG_SEND */
+  int type;               /* event type of an event record */
+  int entity;             /* where the event happens, or who sends */
+  int flags;              /* decisions for a send record */
+  float time;
+  int seqnum;             /* of the packet, -1 for other events */
+  int acknum;
+  double value;           /* the delay draw, if EVLOG_DELAY */
+};
+
+struct evlog;
+
+/* open a log to write or to read; prints why and returns NULL if it can't */
+extern struct evlog *evlog_open(const char *path, int writing);
+extern void evlog_write(struct evlog *, const struct evrecord *);
+/* returns 0 at the end of the log */
+extern int evlog_read(struct evlog *, struct evrecord *);
+extern void evlog_close(struct evlog *);
+
+/* print the log at path as text; returns 0 if it can't be read */
+extern int evlog_decode(const char *path, FILE *out);
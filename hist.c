@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <math.h>
+#include "hist.h"
+
+/* ******************************************************************
+   Histogram buckets.  A value of v ticks with its highest set bit at
+   position msb >= HISTSUBBITS + 1 is shifted right until it has
+   HISTSUBBITS + 1 bits left; the top one is always set, and the rest
+   pick one of the HISTSUB buckets of that power of two.
+   *******************************************************************/
+
+static int bucket(uint64_t v)
+{
+  int shift;
+
+  if (v < 2 * HISTSUB)
+    return (int)v;
+  shift = 63 - __builtin_clzll(v) - HISTSUBBITS;
+  return 2 * HISTSUB + (shift - 1) * HISTSUB + (int)((v >> shift) - HISTSUB);
+}
+
+/* the number of ticks just above those that fall in bucket i */
+static uint64_t upper(int i)
+{
+  int shift;
+
+  if (i < 2 * HISTSUB)
+    return (uint64_t)i + 1;
+  shift = (i - 2 * HISTSUB) / HISTSUB + 1;
+  return (uint64_t)(HISTSUB + (i - 2 * HISTSUB) % HISTSUB + 1) << shift;
+}
+
+void hist_add(struct hist *h, double value)
+{
+  double ticks = value * HISTTICKS;
+  uint64_t v;
+
+  if (ticks < 0.0)
+    ticks = 0.0;
+  else if (ticks > 9e18)
+    ticks = 9e18;
+  v = (uint64_t)llround(ticks);
+  h->counts[bucket(v)]++;
+  h->n++;
+  h->ticks += v;
+  if (value > h->max)
+    h->max = value;
+}
+
+double hist_percentile(const struct hist *h, double p)
+{
+  long long rank, seen = 0;
+  double value;
+  int i;
+
+  if (h->n == 0)
+    return 0.0;
+  rank = (long long)ceil(p * h->n);
+  if (rank < 1)
+    rank = 1;
+  for (i = 0; i < HISTBUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank)
+      break;
+  }
+  value = (double)upper(i) / HISTTICKS;
+  return value < h->max ? value : h->max;
+}
+
+double hist_mean(const struct hist *h)
+{
+  return h->n > 0 ? (double)h->ticks / HISTTICKS / h->n : 0.0;
+}
+
+void hist_merge(struct hist *into, const struct hist *from)
+{
+  int i;
+
+  for (i = 0; i < HISTBUCKETS; i++)
+    into->counts[i] += from->counts[i];
+  into->n += from->n;
+  into->ticks += from->ticks;
+  if (from->max > into->max)
+    into->max = from->max;
+}
@@ -0,0 +1,29 @@
+/* needs stdint.h */
+
+/* A log-linear histogram in the style of HdrHistogram.  Values are
+   counted in ticks of 1/HISTTICKS time units: exactly below 2*HISTSUB
+   ticks, and above that in HISTSUB buckets to each power of two, so a
+   percentile is within 1/HISTSUB of the true value whatever its size.
+   Adding a value is a count leading zeros and an increment. */
+
+#define HISTTICKS  1024         /* ticks per time unit */
+#define HISTSUBBITS 7
+#define HISTSUB    (1 << HISTSUBBITS)
+#define HISTBUCKETS (2 * HISTSUB + (63 - HISTSUBBITS) * HISTSUB)
+
+struct hist {
+  uint64_t counts[HISTBUCKETS];
+  long long n;                    /* values added */
+  uint64_t ticks;                 /* their sum in ticks, which unlike a floating
+                                     point sum is the same in any order */
+  double max;
+};
+
+extern void hist_add(struct hist *, double value);
+/* the top of the bucket holding the value that fraction p of the values
+   are no larger than, or 0 if there are no values; never more than the
+   largest value added */
+extern double hist_percentile(const struct hist *, double p);
+extern double hist_mean(const struct hist *);
+/* add the values of from to into */
+extern void hist_merge(struct hist *into, const struct hist *from);
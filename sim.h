@@ -0,0 +1,90 @@
+/* needs emulator.h and sr.h */
+
+/* Interface between the simulator core in emulator.c and the drivers
+   that run it: the command line front end and the parameter sweep.
+   Everything a run needs is in a struct simconfig and everything it
+   reports comes back in a struct simresult, so several simulations can
+   run at once on different threads. */
+
+/* the link from one side to the other; with a bandwidth of 0 the
+   original delay model of 1 to 10 time units after the packet ahead is
+   used instead */
+#define JITTER_UNIFORM     0
+#define JITTER_EXPONENTIAL 1
+
+struct linkconfig {
+  float bandwidth;        /* bytes per time unit, 0 for the original model */
+  float propdelay;        /* propagation delay */
+  float jitter;           /* most (uniform) or mean (exponential) extra delay */
+  int jitterdist;         /* JITTER_UNIFORM or JITTER_EXPONENTIAL */
+  int queue;              /* packets that can wait to be sent, 0 for no limit */
+};
+
+struct simconfig {
+  int nsimmax;            /* number of msgs to generate, then stop */
+  float lossprob;         /* probability that a packet is dropped  */
+  float corruptprob;      /* probability that one bit is packet is flipped */
+  int corruptdirection;   /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;           /* arrival rate of messages from layer 5 */
+  int trace;              /* TRACE level of the run */
+  int tracemask;          /* the TRACE_ subsystems traced */
+  unsigned int seed;      /* random number generator seed */
+  int payload;            /* bytes in each message, at most MAXPAYLOAD */
+  int payloadmin;         /* if less, lengths are uniform on [payloadmin, payload] */
+  float bytetime;         /* time to put one byte of a packet onto the channel */
+  struct linkconfig link[2];  /* the links from A to B and from B to A */
+  struct srconfig sr;     /* protocol parameters */
+  int flows;              /* connections, each its own A and B sending nsimmax msgs */
+  int bottleneck;         /* the flows share one link each way rather than one each */
+  int parallel;           /* threads to split the flows between, 1 for this one alone */
+  char *record;           /* write an event log here, or NULL */
+  char *replay;           /* take the channel's decisions from this log, or NULL */
+  char *samples;          /* write a time series of the run here, or NULL */
+  float sampleinterval;   /* simulated time between samples */
+  char *checkpoint;       /* save the whole state of the run here once, or NULL:... */
+  float checkpointat;     /* ...before the first event after this time, if >= 0,... */
+  long long checkpointevents;  /* ...or once this many events have run, if > 0 */
+  int checkpointexit;     /* end the run once the checkpoint is saved */
+  char *restore;          /* carry on from the state saved here, or NULL */
+};
+
+struct simresult {
+  float time;             /* simulated time at termination */
+  int nsim;               /* number of messages from 5 to 4 */
+  int ntolayer3;          /* number sent into layer 3 */
+  int nsent[2];           /* number sent into layer 3 by A and by B */
+  int nlost;              /* number lost in media */
+  int ncorrupt;           /* number corrupted by media */
+  int nqueuedrop;         /* number dropped by a full link queue */
+  int messages_delivered; /* number delivered to layer 5 */
+  long long bytes_delivered; /* bytes of data in them */
+  long long nevents;      /* events taken off the event list */
+  int maxevents;          /* the longest the event list got, added over the lists
+                             of a parallel run */
+  long evmemory;          /* bytes held for events and the event list at the end */
+  double latmean;         /* time from layer 5 to delivery: the mean,... */
+  double latp50, latp99, latp999;  /* ...percentiles... */
+  double latmax;          /* ...and the longest */
+  int nflows;             /* connections */
+  int flowmin, flowmax;   /* the fewest and most messages one of them delivered */
+  double fairness;        /* Jain's fairness index of the messages they delivered */
+  struct protostats stats;  /* counters kept by the protocol */
+};
+
+/* formats for the statistics report */
+#define STATS_TEXT 0
+#define STATS_JSON 1
+#define STATS_CSV  2
+
+/* fill in the batch defaults */
+extern void simdefaults(struct simconfig *);
+
+/* set a parameter by name; returns 0 if the name or value is not valid */
+extern int setparam(struct simconfig *, const char *name, const char *value);
+
+/* run one simulation to completion on the calling thread */
+extern void runsim(const struct simconfig *, struct simresult *);
+
+/* write a run as one JSON object or CSV row, with a CSV header if asked */
+extern void writeresult(FILE *, int format, int header,
+                        const struct simconfig *, const struct simresult *);
@@ -0,0 +1,43 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "spsc.h"
+
+int spsc_init(struct spsc *q, size_t size, size_t cap)
+{
+  q->size = size;
+  q->cap = cap;
+  atomic_init(&q->head, 0);
+  atomic_init(&q->tail, 0);
+  q->slots = malloc(size * cap);
+  return q->slots != NULL;
+}
+
+void spsc_free(struct spsc *q)
+{
+  free(q->slots);
+  q->slots = NULL;
+}
+
+int spsc_push(struct spsc *q, const void *elem)
+{
+  size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&q->tail, memory_order_acquire) == q->cap)
+    return 0;
+  memcpy(q->slots + (head & (q->cap - 1)) * q->size, elem, q->size);
+  atomic_store_explicit(&q->head, head + 1, memory_order_release);
+  return 1;
+}
+
+int spsc_pop(struct spsc *q, void *elem)
+{
+  size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+
+  if (atomic_load_explicit(&q->head, memory_order_acquire) == tail)
+    return 0;
+  memcpy(elem, q->slots + (tail & (q->cap - 1)) * q->size, q->size);
+  atomic_store_explicit(&q->tail, tail + 1, memory_order_release);
+  return 1;
+}
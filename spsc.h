@@ -0,0 +1,23 @@
+/* needs stddef.h and stdatomic.h */
+
+/* A bounded ring of fixed size elements between one producer thread and
+   one consumer thread, without locks: each side writes only its own
+   count and reads the other's with acquire ordering, so that it sees
+   the elements the other side put in or took out before it. */
+
+struct spsc {
+  char *slots;
+  size_t size;                    /* bytes in an element */
+  size_t cap;                     /* elements in the ring, a power of two */
+  atomic_size_t head;             /* elements put in, by the producer */
+  char pad[64];                   /* keep the two counts on their own cache lines */
+  atomic_size_t tail;             /* elements taken out, by the consumer */
+};
+
+/* returns 0 if the ring could not be allocated */
+extern int spsc_init(struct spsc *, size_t size, size_t cap);
+extern void spsc_free(struct spsc *);
+/* returns 0 if the ring is full */
+extern int spsc_push(struct spsc *, const void *elem);
+/* returns 0 if the ring is empty */
+extern int spsc_pop(struct spsc *, void *elem);
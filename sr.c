@@ -1,9 +1,19 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <string.h>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 #include "emulator.h"
 #include "sr.h"
-#include <string.h>
+#include "trace.h"
+#include "ckpt.h"
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -24,362 +34,1374 @@
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE (2 * WINDOWSIZE)  /* for Selective Repeat: sequence space must be at least 2 × window size to avoid ambiguity */
+#define DEFAULTWINDOW 6 /* the maximum number of buffered unacked packet, unless --window is given */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+/* With --rto=adaptive the timeout follows the measured round trip time
+   the way TCP's does (Jacobson's SRTT/RTTVAR estimator, RFC 6298): only
+   packets that were never resent give a sample (Karn's rule), and every
+   timeout doubles the timeout until the next new ACK brings it back.  The
+   default fixed mode always uses the timeout given, RTT unless changed. */
+/* With --nack=1 every ACK B sends while it holds packets beyond a gap
+   also names the first missing sequence number, in the otherwise unused
+   seqnum field.  The channel never reorders, so if the ACKed packet was
+   first sent after the missing one was last sent, that copy of the
+   missing one is gone and A resends it at once instead of waiting for
+   its timer. */
+/* With --bidirectional=1 B sends data too, through B_output(), and each
+   side runs both a sender and a receiver.  An ACK then waits up to
+   --ack-delay for a data packet going the other way to ride on, and is
+   only sent in a packet of its own if none comes. */
+
+/* With --ack-mode=sack an ACK names the last packet received in order,
+   acknowledging everything up to it, and its payload is a bitmap of the
+   packets after it that are already buffered (bit i for the i+2nd packet
+   after the cumulative ACK).  The receiver then ACKs every --ack-every
+   in-order packets, or after --ack-delay if fewer come, and at once when
+   a packet is out of order or a duplicate.  With --nack=1 the sender
+   resends the holes below a SACKed packet under the same rule as a NACK. */
+#define ACK_SINGLE 0
+#define ACK_SACK   1
+
+/* With --congestion=1 the packets in flight are also limited by a
+   congestion window, as in TCP: it starts at one packet, grows by one
+   for each new ACK until ssthresh (slow start) and by 1/cwnd after that
+   (congestion avoidance), and never passes the receiver's window.  A
+   timeout halves ssthresh and closes cwnd to one packet, a fast
+   retransmit halves both, and only a loss among packets sent since the
+   last cut makes another. */
+
+#define RTOMIN 2.0      /* the shortest possible round trip */
+#define RTOMAX (64 * RTT)
+
+/* The window size is normally chosen at start up, and for Selective Repeat
+   the sequence space is always 2 × window size to avoid ambiguity.  When
+   the window is a power of two sequence numbers wrap with a mask instead
+   of a division.  Building with -DWINDOWSIZE=n fixes the window at compile
+   time instead, so that the compiler can fold all of the arithmetic. */
+#ifdef WINDOWSIZE
+#define WINDOW WINDOWSIZE
+#define SEQSPACE (2 * WINDOWSIZE)
+#define SEQMOD(x) ((int)((unsigned)(x) % SEQSPACE))
+#define SLOT(seq) ((int)((unsigned)(seq) % WINDOW))
+#else
+#define WINDOW (sr->window)
+#define SEQSPACE (sr->seqspace)
+#define SEQMOD(x) (sr->seqmask ? (int)((unsigned)(x) & sr->seqmask) : (x) % sr->seqspace)
+#define SLOT(seq) (sr->seqmask ? (int)((unsigned)(seq) & (sr->seqmask >> 1)) : (seq) % sr->window)
+#endif
+
+/* how many sequence numbers b must advance to reach a; the window buffers
+   are rings indexed by SLOT(seqnum), which is unique within a window */
+#define SEQDIST(a, b) SEQMOD((a) - (b) + SEQSPACE)
+
+#define TESTBIT(map, i)  (((map)[(i) >> 6] >> ((i) & 63)) & 1)
+#define SETBIT(map, i)   ((map)[(i) >> 6] |= (uint64_t)1 << ((i) & 63))
+#define CLEARBIT(map, i) ((map)[(i) >> 6] &= ~((uint64_t)1 << ((i) & 63)))
+
+/* a message waiting for room in the send window */
+struct queued {
+  struct msg message;
+  float queuedat;                 /* when it arrived from layer 5 */
+};
+
+/* Each side has a sender and a receiver.  With --bidirectional=0, the
+   assignment's setting, only A's sender and B's receiver are used. */
+struct srside {
+  int entity;                     /* A or B */
+  char name;                      /* 'A' or 'B', for traces */
+
+  /* sender */
+  struct pkt *buffer;             /* ring of packets sent but not yet slid out of the window */
+  uint64_t *acked;                /* bitmap over the ring: slot has been ACKed */
+  int windowfirst;                /* sequence number of the oldest packet in the window */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  struct queued *backlog;         /* ring of messages that arrived while the window was full */
+  int qfirst;                     /* the oldest queued message */
+  int qcount;                     /* the number of messages queued */
+
+  /* per-packet timers, kept in a min-heap of slots ordered by deadline
+     and multiplexed onto the emulator's single timer for this side; the
+     extra slot ACKSLOT is the delayed ACK timer */
+  float *deadline;                /* when the packet in each slot times out */
+  int *theap;                     /* slots with a running timer */
+  int *tpos;                      /* position of each slot in theap, -1 if none */
+  int tcount;                     /* number of running timers */
+  int timerrunning;               /* the emulator timer is started... */
+  float armedfor;                 /* ...for this deadline */
+  float lastslide;                /* when the window last slid */
+  float ackedsent;                /* the latest first sending of a packet ACKed */
+
+  /* retransmission timeout */
+  float rto;                      /* the current timeout */
+  float srtt;                     /* smoothed round trip time, 0 before the first sample */
+  float rttvar;                   /* round trip time variation */
+  float *senttime;                /* when the packet in each slot was first sent */
+  float *lastsent;                /* when it was last sent */
+  uint64_t *resent;               /* bitmap over the ring: slot has been resent */
+
+  /* congestion window */
+  float cwnd;                     /* packets that may be in flight */
+  float ssthresh;                 /* where slow start ends */
+  float lastcut;                  /* when cwnd was last cut */
+
+  /* receiver */
+  struct pkt *buffer_b;           /* ring of out-of-order packets waiting for the base */
+  uint64_t *received;             /* bitmap over the ring: slot holds a buffered packet */
+  int expectedseqnum;             /* the sequence number expected next by the receiver */
+  int ackpending;                 /* an ACK is waiting for a data packet to ride on... */
+  int pendingack;                 /* ...for this sequence number */
+  int unacked;                    /* with ACK_SACK, in-order packets not ACKed yet */
+};
+
+/* The state of both entities lives in a struct srstate so that each
+   simulation has its own; the emulator selects the one to use with
+   sr_select() before calling any of the routines below. */
+struct srstate {
+  int window;                     /* window size */
+  int seqspace;                   /* 2 * window */
+  unsigned seqmask;               /* seqspace - 1 if that is a power of two, else 0 */
+
+  int adaptive;                   /* the timeout is estimated, not fixed */
+  int nack;                       /* NACK missing packets, and act on NACKs */
+  int qsize;                      /* backlog capacity, 0 to drop messages instead */
+  int checksum;                   /* CHECKSUM_SUM, CHECKSUM_INET or CHECKSUM_CRC32C */
+  int bidirectional;              /* both sides send data */
+  float ackdelay;                 /* how long an ACK may wait for a data packet */
+  int congestion;                 /* use the congestion window */
+  int ackmode;                    /* ACK_SINGLE or ACK_SACK */
+  int ackevery;                   /* with ACK_SACK, in-order packets per ACK */
+
+  struct srside side[2];          /* A and B */
+};
+
+static _Thread_local struct srstate *sr;
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
    original checksum.  This procedure must generate a different checksum to the original if
    the packet is corrupted.
+
+   The default is the original sum of the header fields and the payload
+   bytes, worked out a machine word at a time.  --checksum=inet uses the
+   Internet checksum (RFC 1071) over the header, length and payload
+   instead, and --checksum=crc32c a CRC32C, which catches every burst of
+   up to 32 bits and uses the CPU's CRC instruction when built for SSE4.2
+   or ARMv8 CRC.  A length that cannot be right is always corruption.
 */
-int ComputeChecksum(struct pkt packet)
+#define CHECKSUM_SUM    0
+#define CHECKSUM_INET   1
+#define CHECKSUM_CRC32C 2
+
+/* the payload bytes summed as (int)char, whatever the signedness of char */
+static int payloadsum(const char *payload, int length)
 {
-  int checksum = 0;
+  const uint64_t lo = 0x00ff00ff00ff00ffULL;
+  const uint64_t high = 0x8080808080808080ULL;
+  uint64_t w, lanes;
+  int sum = 0, highbytes = 0;
+  int i, chunkend;
+
+  /* the bytes of each word are added pairwise into 16 bit lanes and the
+     lanes added with a multiply; 256 bytes at a time, so that the total
+     fits in the top lane */
+  for (i = 0; i < length; i = chunkend) {
+    chunkend = i + 256 < length ? i + 256 : length;
+    lanes = 0;
+    for (; i < chunkend; i += 8) {
+      w = 0;
+      memcpy(&w, payload + i, chunkend - i < 8 ? chunkend - i : 8);
+      lanes += (w & lo) + ((w >> 8) & lo);
+      highbytes += __builtin_popcountll(w & high);
+    }
+    sum += (int)((lanes * 0x0001000100010001ULL) >> 48);
+  }
+
+  /* with a signed char every byte of 0x80 or more counts 256 less */
+  if ((char)-1 < 0)
+    sum -= 256 * highbytes;
+  return sum;
+}
+
+/* the stronger checksums cover the header fields, the length and the payload */
+static int inetchecksum(const struct pkt *packet)
+{
+  uint64_t sum;
+  uint32_t w;
   int i;
 
-  checksum = packet.seqnum;
-  checksum += packet.acknum;
-  for ( i=0; i<20; i++ ) 
-    checksum += (int)(packet.payload[i]);
+  /* summing 32 bit words and folding the carries gives the same 16 bit
+     one's complement sum as adding 16 bit words */
+  sum = (uint64_t)(uint32_t)packet->seqnum + (uint32_t)packet->acknum + (uint32_t)packet->length;
+  for (i = 0; i < packet->length; i += 4) {
+    w = 0;
+    memcpy(&w, packet->payload + i, packet->length - i < 4 ? packet->length - i : 4);
+    sum += w;
+  }
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return (int)(~sum & 0xffff);
+}
+
+#if defined(__SSE4_2__)
+#define CRCWORD(crc, w) _mm_crc32_u32(crc, w)
+#define CRCBYTE(crc, b) _mm_crc32_u8(crc, b)
+#elif defined(__ARM_FEATURE_CRC32)
+#define CRCWORD(crc, w) __crc32cw(crc, w)
+#define CRCBYTE(crc, b) __crc32cb(crc, b)
+#else
+static const uint32_t crcnibble[16] = {
+  0x00000000, 0x105ec76f, 0x20bd8ede, 0x30e349b1, 0x417b1dbc, 0x5125dad3, 0x61c69362, 0x7198540d,
+  0x82f63b78, 0x92a8fc17, 0xa24bb5a6, 0xb21572c9, 0xc38d26c4, 0xd3d3e1ab, 0xe330a81a, 0xf36e6f75
+};
 
-  return checksum;
+static uint32_t crcbits(uint32_t crc, int nbits)
+{
+  for (; nbits > 0; nbits -= 4)
+    crc = (crc >> 4) ^ crcnibble[crc & 15];
+  return crc;
+}
+#define CRCWORD(crc, w) crcbits((crc) ^ (w), 32)
+#define CRCBYTE(crc, b) crcbits((crc) ^ (b), 8)
+#endif
+
+static int crc32c(const struct pkt *packet)
+{
+  uint32_t crc = 0xffffffff;
+  uint32_t w;
+  int i;
+
+  crc = CRCWORD(crc, (uint32_t)packet->seqnum);
+  crc = CRCWORD(crc, (uint32_t)packet->acknum);
+  crc = CRCWORD(crc, (uint32_t)packet->length);
+  for (i = 0; i + 4 <= packet->length; i += 4) {
+    memcpy(&w, packet->payload + i, 4);
+    crc = CRCWORD(crc, w);
+  }
+  for (; i < packet->length; i++)
+    crc = CRCBYTE(crc, (unsigned char)packet->payload[i]);
+  return (int)~crc;
+}
+
+int ComputeChecksum(const struct pkt *packet)
+{
+  if (sr->checksum == CHECKSUM_INET)
+    return inetchecksum(packet);
+  if (sr->checksum == CHECKSUM_CRC32C)
+    return crc32c(packet);
+  return packet->seqnum + packet->acknum + payloadsum(packet->payload, packet->length);
 }
 
-int IsCorrupted(struct pkt packet)
+int IsCorrupted(const struct pkt *packet)
 {
-  if (packet.checksum == ComputeChecksum(packet))
+  if (packet->length < 0 || packet->length > MAXPAYLOAD)
+    return 0;
+  if (packet->checksum == ComputeChecksum(packet))
     return -1;
   else
     return 0;
 }
 
-/********* Sender (A) variables and functions ************/
+void sr_defaults(struct srconfig *cfg)
+{
+#ifdef WINDOWSIZE
+  cfg->windowsize = WINDOWSIZE;
+#else
+  cfg->windowsize = DEFAULTWINDOW;
+#endif
+  cfg->adaptive = 0;
+  cfg->timeout = RTT;
+  cfg->nack = 0;
+  cfg->backlog = 0;
+  cfg->checksum = CHECKSUM_SUM;
+  cfg->bidirectional = 0;
+  cfg->ackdelay = RTT / 4;
+  cfg->ackmode = ACK_SINGLE;
+  cfg->ackevery = 2;
+  cfg->congestion = 0;
+}
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+int sr_setparam(struct srconfig *cfg, const char *name, const char *value)
+{
+  char *end;
+  long n;
+  double t;
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+  if (strcmp(name, "window") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 1 || n > (1 << 24))
+      return 0;
+#ifdef WINDOWSIZE
+    if (n != WINDOWSIZE)
+      return 0;     /* this build has the window fixed */
+#endif
+    cfg->windowsize = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "rto") == 0) {
+    if (strcmp(value, "fixed") == 0 || strcmp(value, "0") == 0)
+      cfg->adaptive = 0;
+    else if (strcmp(value, "adaptive") == 0 || strcmp(value, "1") == 0)
+      cfg->adaptive = 1;
+    else
+      return 0;
+    return 1;
+  }
+  if (strcmp(name, "checksum") == 0) {
+    if (strcmp(value, "sum") == 0 || strcmp(value, "0") == 0)
+      cfg->checksum = CHECKSUM_SUM;
+    else if (strcmp(value, "inet") == 0 || strcmp(value, "1") == 0)
+      cfg->checksum = CHECKSUM_INET;
+    else if (strcmp(value, "crc32c") == 0 || strcmp(value, "2") == 0)
+      cfg->checksum = CHECKSUM_CRC32C;
+    else
+      return 0;
+    return 1;
+  }
+  if (strcmp(name, "backlog") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 0 || n > (1 << 24))
+      return 0;
+    cfg->backlog = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "nack") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 0 || n > 1)
+      return 0;
+    cfg->nack = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "bidirectional") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 0 || n > 1)
+      return 0;
+    cfg->bidirectional = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "congestion") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 0 || n > 1)
+      return 0;
+    cfg->congestion = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "ack-mode") == 0) {
+    if (strcmp(value, "single") == 0 || strcmp(value, "0") == 0)
+      cfg->ackmode = ACK_SINGLE;
+    else if (strcmp(value, "sack") == 0 || strcmp(value, "1") == 0)
+      cfg->ackmode = ACK_SACK;
+    else
+      return 0;
+    return 1;
+  }
+  if (strcmp(name, "ack-every") == 0) {
+    n = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || n < 1 || n > (1 << 24))
+      return 0;
+    cfg->ackevery = (int)n;
+    return 1;
+  }
+  if (strcmp(name, "ack-delay") == 0) {
+    t = strtod(value, &end);
+    if (end == value || *end != '\0' || !(t >= 0.0))
+      return 0;
+    cfg->ackdelay = (float)t;
+    return 1;
+  }
+  if (strcmp(name, "timeout") == 0) {
+    t = strtod(value, &end);
+    if (end == value || *end != '\0' || !(t > 0.0))
+      return 0;
+    cfg->timeout = (float)t;
+    return 1;
+  }
+  return -1;
+}
+
+/* allocate what a side needs of the sender and of the receiver */
+static void allocside(struct srstate *state, struct srside *side, int sender, int receiver)
 {
-  struct pkt sendpkt;
+  int w = state->window;
+
+  if (sender) {
+    side->buffer = calloc(w, sizeof(struct pkt));
+    side->acked = calloc((w + 63) / 64, sizeof(uint64_t));
+    side->senttime = calloc(w, sizeof(float));
+    side->lastsent = calloc(w, sizeof(float));
+    side->resent = calloc((w + 63) / 64, sizeof(uint64_t));
+    side->backlog = calloc(state->qsize > 0 ? state->qsize : 1, sizeof(struct queued));
+    if (side->buffer == NULL || side->acked == NULL || side->senttime == NULL ||
+        side->lastsent == NULL || side->resent == NULL || side->backlog == NULL) {
+      printf("memory allocation for protocol state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (receiver) {
+    side->buffer_b = calloc(w, sizeof(struct pkt));
+    side->received = calloc((w + 63) / 64, sizeof(uint64_t));
+    if (side->buffer_b == NULL || side->received == NULL) {
+      printf("memory allocation for protocol state failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  /* the timers, one per window slot and one for a delayed ACK */
+  side->deadline = calloc(w + 1, sizeof(float));
+  side->theap = calloc(w + 1, sizeof(int));
+  side->tpos = calloc(w + 1, sizeof(int));
+  if (side->deadline == NULL || side->theap == NULL || side->tpos == NULL) {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void freeside(struct srside *side)
+{
+  free(side->buffer);
+  free(side->acked);
+  free(side->senttime);
+  free(side->lastsent);
+  free(side->resent);
+  free(side->backlog);
+  free(side->buffer_b);
+  free(side->received);
+  free(side->deadline);
+  free(side->theap);
+  free(side->tpos);
+}
+
+void *sr_create(const struct srconfig *cfg)
+{
+  struct srstate *state = calloc(1, sizeof(struct srstate));
   int i;
-  int index;
-  int seqfirst = windowfirst;
-  int seqlast = (windowfirst + WINDOWSIZE - 1) % SEQSPACE;
 
-  /* if not blocked waiting on ACK */
-  if (((seqfirst <= seqlast) && (A_nextseqnum >= seqfirst && A_nextseqnum <= seqlast)) ||
-      ((seqfirst > seqlast) && (A_nextseqnum >= seqfirst || A_nextseqnum <= seqlast)))
-  {
-    if (TRACE > 1)
-      printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
-
-    /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
-    sendpkt.acknum = NOTINUSE;
-    for (i = 0; i < 20 ; i++) 
-      sendpkt.payload[i] = message.data[i];
-    sendpkt.checksum = ComputeChecksum(sendpkt); 
-
-    /* put packet in window buffer */
-    /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    if (A_nextseqnum >= seqfirst)
-      index = A_nextseqnum - seqfirst;
-    else
-      index =  WINDOWSIZE - seqfirst + A_nextseqnum;
-    buffer[index] = sendpkt;
-    windowcount++;
+  if (state == NULL) {
+    printf("memory allocation for protocol state failed.");
+    exit(EXIT_FAILURE);
+  }
+  state->window = cfg->windowsize;
+  state->adaptive = cfg->adaptive;
+  state->nack = cfg->nack;
+  state->qsize = cfg->backlog;
+  state->checksum = cfg->checksum;
+  state->bidirectional = cfg->bidirectional;
+  state->ackdelay = cfg->ackdelay;
+  state->ackmode = cfg->ackmode;
+  state->ackevery = cfg->ackevery;
+  state->congestion = cfg->congestion;
+  state->seqspace = 2 * cfg->windowsize;
+  if ((state->seqspace & (state->seqspace - 1)) == 0)
+    state->seqmask = state->seqspace - 1;
+  for (i = A; i <= B; i++) {
+    state->side[i].entity = i;
+    state->side[i].name = i == A ? 'A' : 'B';
+    state->side[i].rto = cfg->timeout;
+    allocside(state, &state->side[i], i == A || cfg->bidirectional, i == B || cfg->bidirectional);
+  }
+  return state;
+}
 
-    /* send out packet */
-    if (TRACE > 0)
-      printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+void sr_destroy(void *state)
+{
+  struct srstate *st = state;
 
-    /* start timer if first packet in window */
-    if (A_nextseqnum == seqfirst)
-      starttimer(A,RTT);
+  freeside(&st->side[A]);
+  freeside(&st->side[B]);
+  free(st);
+}
+
+void sr_select(void *state)
+{
+  sr = state;
+}
+
+void sr_snapshot(int entity, struct srsnapshot *snap)
+{
+  const struct srside *s = &sr->side[entity];
+
+  memset(snap, 0, sizeof(*snap));
+  if (s->buffer == NULL)
+    return;
+  snap->window = SEQDIST(s->nextseqnum, s->windowfirst);
+  snap->inflight = s->windowcount;
+  snap->queued = s->qcount;
+  snap->cwnd = sr->congestion ? s->cwnd : WINDOW;
+}
+
+/********* Checkpoints ************/
+
+/* The protocol parameters are not saved: a restored run may change
+   them, all but the ones that size the state. */
+
+static int sidecheckpoint(struct srside *s, FILE *fp, int saving)
+{
+  size_t words = (WINDOW + 63) / 64 * sizeof(uint64_t);
+  size_t floats = WINDOW * sizeof(float);
+
+  if (!XFER(s->windowfirst) || !XFER(s->windowcount) || !XFER(s->nextseqnum) ||
+      !XFER(s->qfirst) || !XFER(s->qcount) || !XFER(s->tcount) ||
+      !XFER(s->timerrunning) || !XFER(s->armedfor) || !XFER(s->lastslide) ||
+      !XFER(s->ackedsent) || !XFER(s->rto) ||
+      !XFER(s->srtt) || !XFER(s->rttvar) || !XFER(s->cwnd) || !XFER(s->ssthresh) ||
+      !XFER(s->lastcut) || !XFER(s->expectedseqnum) || !XFER(s->ackpending) ||
+      !XFER(s->pendingack) || !XFER(s->unacked))
+    return 0;
+  if (s->buffer != NULL &&
+      (!xfer(fp, saving, s->buffer, WINDOW * sizeof(struct pkt)) ||
+       !xfer(fp, saving, s->acked, words) ||
+       !xfer(fp, saving, s->senttime, floats) ||
+       !xfer(fp, saving, s->lastsent, floats) ||
+       !xfer(fp, saving, s->resent, words) ||
+       !xfer(fp, saving, s->backlog, (sr->qsize > 0 ? sr->qsize : 1) * sizeof(struct queued))))
+    return 0;
+  if (s->buffer_b != NULL &&
+      (!xfer(fp, saving, s->buffer_b, WINDOW * sizeof(struct pkt)) ||
+       !xfer(fp, saving, s->received, words)))
+    return 0;
+  return xfer(fp, saving, s->deadline, (WINDOW + 1) * sizeof(float)) &&
+         xfer(fp, saving, s->theap, (WINDOW + 1) * sizeof(int)) &&
+         xfer(fp, saving, s->tpos, (WINDOW + 1) * sizeof(int));
+}
+
+int sr_checkpoint(FILE *fp, int saving)
+{
+  int window = sr->window, qsize = sr->qsize, bidirectional = sr->bidirectional;
+
+  if (!XFER(window) || !XFER(qsize) || !XFER(bidirectional))
+    return 0;
+  if (window != sr->window || qsize != sr->qsize || bidirectional != sr->bidirectional) {
+    printf("checkpoint has window %d, backlog %d and bidirectional %d\n",
+           window, qsize, bidirectional);
+    return 0;
+  }
+  return sidecheckpoint(&sr->side[A], fp, saving) &&
+         sidecheckpoint(&sr->side[B], fp, saving);
+}
+
+/********* Window bitmaps ************/
+
+/* the number of consecutive set bits of a window bitmap starting at slot
+   and wrapping round the ring, at most limit; each word of the bitmap is
+   scanned with a single count-trailing-zeros */
+static int bitrun(const uint64_t *map, int slot, int limit)
+{
+  int n = 0;
+  int run, avail;
+  uint64_t unset;
+
+  while (n < limit) {
+    avail = 64 - (slot & 63);
+    if (avail > WINDOW - slot)
+      avail = WINDOW - slot;
+    unset = ~(map[slot >> 6] >> (slot & 63));
+    run = unset ? __builtin_ctzll(unset) : 64;
+    if (run > avail)
+      run = avail;
+    n += run;
+    if (run < avail)
+      break;
+    slot += run;
+    if (slot == WINDOW)
+      slot = 0;
+  }
+  return n < limit ? n : limit;
+}
+
+/* whether any bit of a window bitmap is set */
+static int hasany(const uint64_t *map)
+{
+  int i;
+
+  for (i = 0; i < (WINDOW + 63) / 64; i++)
+    if (map[i] != 0)
+      return 1;
+  return 0;
+}
+
+/* Per-packet timers.  Every unACKed packet has its own deadline, and the
+   emulator's one timer for the side is kept started for the earliest of
+   them.  The emulator timer is only restarted when a deadline earlier
+   than the one it is set for appears; if the earliest packet is ACKed
+   first the timer goes off early, finds nothing expired, and is set
+   again.  A delayed ACK waits in the same heap, in slot ACKSLOT.
+
+   With the fixed timeout the timers have to allow for the original
+   channel, which queues every packet 1 to 10 time units behind the one
+   ahead: a packet deep in the window can time out while it is only
+   waiting, and resending it on its own timer makes the queue longer
+   still until the run collapses.  So, as with the single timer, every
+   timer starts again when the window slides, and a packet other than the
+   oldest is only resent when a packet first sent after it has been ACKed,
+   which the channel can't do unless the packet is lost; otherwise its
+   timer starts again.  The adaptive timeout backs off instead. */
+#define ACKSLOT WINDOW
+
+/* earlier deadline first; then the delayed ACK, then packets in sequence order */
+static int timerbefore(const struct srside *s, int a, int b)
+{
+  if (s->deadline[a] != s->deadline[b])
+    return s->deadline[a] < s->deadline[b];
+  if (a == ACKSLOT || b == ACKSLOT)
+    return a == ACKSLOT;
+  return SEQDIST(s->buffer[a].seqnum, s->windowfirst) < SEQDIST(s->buffer[b].seqnum, s->windowfirst);
+}
+
+static void tswap(struct srside *s, int i, int j)
+{
+  int tmp = s->theap[i];
+
+  s->theap[i] = s->theap[j];
+  s->theap[j] = tmp;
+  s->tpos[s->theap[i]] = i;
+  s->tpos[s->theap[j]] = j;
+}
+
+static void tsiftup(struct srside *s, int i)
+{
+  while (i > 0 && timerbefore(s, s->theap[i], s->theap[(i-1)/2])) {
+    tswap(s, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void tsiftdown(struct srside *s, int i)
+{
+  int child;
+
+  for (;;) {
+    child = 2*i + 1;
+    if (child >= s->tcount)
+      return;
+    if (child+1 < s->tcount && timerbefore(s, s->theap[child+1], s->theap[child]))
+      child++;
+    if (!timerbefore(s, s->theap[child], s->theap[i]))
+      return;
+    tswap(s, i, child);
+    i = child;
+  }
+}
+
+static void canceltimer(struct srside *s, int slot)
+{
+  int i = s->tpos[slot];
+
+  if (i < 0)
+    return;
+  s->tpos[slot] = -1;
+  if (i == --s->tcount)
+    return;
+  s->theap[i] = s->theap[s->tcount];
+  s->tpos[s->theap[i]] = i;
+  tsiftup(s, i);
+  tsiftdown(s, s->tpos[s->theap[i]]);
+}
+
+/* (re)start the timer of the packet in slot to time out at deadline */
+static void settimer(struct srside *s, int slot, float deadline)
+{
+  canceltimer(s, slot);
+  s->deadline[slot] = deadline;
+  s->tpos[slot] = s->tcount;
+  s->theap[s->tcount++] = slot;
+  tsiftup(s, s->tpos[slot]);
+}
+
+/* make sure the emulator timer goes off no later than the earliest deadline */
+static void armtimer(struct srside *s)
+{
+  float first;
 
-    /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+  if (s->tcount == 0) {
+    if (s->timerrunning)
+      stoptimer(s->entity);
+    s->timerrunning = 0;
+    return;
+  }
+  first = s->deadline[s->theap[0]];
+  if (s->timerrunning && s->armedfor <= first)
+    return;
+  if (s->timerrunning)
+    stoptimer(s->entity);
+  starttimer(s->entity, first - currenttime());
+  s->timerrunning = 1;
+  s->armedfor = first;
+}
+
+/* the timeout the estimate gives, without any backoff */
+static void rtofromestimate(struct srside *s)
+{
+  s->rto = s->srtt + 4 * s->rttvar;
+  if (s->rto < RTOMIN)
+    s->rto = RTOMIN;
+  if (s->rto > RTOMAX)
+    s->rto = RTOMAX;
+}
+
+/* feed the estimator the round trip time of a packet that was sent once */
+static void rttsample(struct srside *s, float rtt)
+{
+  if (s->srtt == 0.0) {
+    s->srtt = rtt;
+    s->rttvar = rtt / 2;
+  }
+  else {
+    s->rttvar = 0.75 * s->rttvar + 0.25 * fabs(s->srtt - rtt);
+    s->srtt = 0.875 * s->srtt + 0.125 * rtt;
+  }
+  rtofromestimate(s);
+  if (TRACEON(TRACE_SENDER, 2))
+    tprintf("----%c: rtt %.3f, srtt %.3f, rttvar %.3f, timeout now %.3f\n",
+           s->name, rtt, s->srtt, s->rttvar, s->rto);
+}
+
+/********* Congestion window ************/
+
+/* a new ACK: slow start, or congestion avoidance past ssthresh */
+static void growwindow(struct srside *s)
+{
+  if (!sr->congestion)
+    return;
+  if (s->cwnd < s->ssthresh)
+    s->cwnd += 1.0;
+  else
+    s->cwnd += 1.0 / s->cwnd;
+  if (s->cwnd > WINDOW)
+    s->cwnd = WINDOW;
+}
+
+/* the packet in slot was lost: cut the window, unless it was on its way
+   before the last cut and so is part of the same loss */
+static void cutwindow(struct srside *s, int slot, int timeout)
+{
+  if (!sr->congestion || s->lastsent[slot] < s->lastcut)
+    return;
+  s->lastcut = currenttime();
+  s->ssthresh = s->windowcount / 2.0 > 2.0 ? s->windowcount / 2.0 : 2.0;
+  s->cwnd = timeout ? 1.0 : s->ssthresh;
+  stats->cwnd_cuts++;
+  if (TRACEON(TRACE_SENDER, 2))
+    tprintf("----%c: congestion window cut to %.2f, ssthresh %.2f\n", s->name, s->cwnd, s->ssthresh);
+}
+
+/********* Sending ACKs ************/
+
+/* the cumulative ACK: the last packet received in order */
+#define CUMACK(s) SEQMOD((s)->expectedseqnum - 1 + SEQSPACE)
+
+/* n <= 64 bits of a window bitmap from slot on, wrapping round the ring */
+static uint64_t getbits(const uint64_t *map, int slot, int n)
+{
+  uint64_t bits = 0, w;
+  int got = 0, take;
+
+  while (got < n) {
+    take = 64 - (slot & 63);
+    if (take > WINDOW - slot)
+      take = WINDOW - slot;
+    if (take > n - got)
+      take = n - got;
+    w = map[slot >> 6] >> (slot & 63);
+    if (take < 64)
+      w &= ((uint64_t)1 << take) - 1;
+    bits |= w << got;
+    got += take;
+    slot += take;
+    if (slot == WINDOW)
+      slot = 0;
+  }
+  return bits;
+}
+
+/* write the SACK bitmap of the receiver into payload and return its
+   length, without the trailing zero bytes */
+static int sackbitmap(const struct srside *s, char *payload)
+{
+  int nbits = WINDOW - 1 < 8 * MAXPAYLOAD ? WINDOW - 1 : 8 * MAXPAYLOAD;
+  int i, n, length = 0;
+  uint64_t bits;
+
+  for (i = 0; i < nbits; i += 64) {
+    n = nbits - i < 64 ? nbits - i : 64;
+    bits = getbits(s->received, SLOT(s->expectedseqnum + 1 + i), n);
+    memcpy(payload + i / 8, &bits, (n + 7) / 8);
+    if (bits != 0)
+      length = i / 8 + (64 - __builtin_clzll(bits) + 7) / 8;
+  }
+  return length;
+}
+
+/* send a packet of its own ACKing seqnum, or with ACK_SACK the packets
+   received so far */
+static void sendack(struct srside *s, int seqnum)
+{
+  struct pkt sendpkt;
+
+  /* create sendpkt */
+  /* send an ACK for the received packet */
+  sendpkt.acknum = seqnum;
+  sendpkt.seqnum = NOTINUSE;
+
+  /* we don't have any data to send, so the payload is empty */
+  sendpkt.length = 0;
+
+  if (sr->ackmode == ACK_SACK) {
+    sendpkt.acknum = CUMACK(s);
+    sendpkt.length = sackbitmap(s, sendpkt.payload);
+    s->unacked = 0;
+    if (s->ackpending) {
+      s->ackpending = 0;
+      canceltimer(s, ACKSLOT);
+    }
+  }
+  /* with packets buffered past the base, NACK the base */
+  else if (sr->nack && hasany(s->received))
+    sendpkt.seqnum = s->expectedseqnum;
+
+  /* computer checksum */
+  sendpkt.checksum = ComputeChecksum(&sendpkt);
+
+  /* send ack */
+  tolayer3_ptr(s->entity, &sendpkt);
+}
+
+/* send the delayed ACK now, if there is one */
+static void flushack(struct srside *s)
+{
+  if (!s->ackpending)
+    return;
+  s->ackpending = 0;
+  canceltimer(s, ACKSLOT);
+  sendack(s, s->pendingack);
+}
+
+/* let an ACK wait for up to ackdelay */
+static void delayack(struct srside *s, int seqnum)
+{
+  s->ackpending = 1;
+  s->pendingack = seqnum;
+  settimer(s, ACKSLOT, currenttime() + sr->ackdelay);
+  armtimer(s);
+}
+
+/* ACK seqnum, which arrived in order or not.  An SR ACK names a single
+   packet: when this side sends data too the ACK waits a little for a
+   data packet to ride on, otherwise it goes at once, and an ACK still
+   waiting when the next is due is sent on its own first.  A cumulative
+   ACK covers everything before it, so it can wait for more packets. */
+static void ackpacket(struct srside *s, int seqnum, int inorder)
+{
+  if (sr->ackmode == ACK_SACK) {
+    if (!inorder || sr->ackdelay <= 0.0 || ++s->unacked >= sr->ackevery)
+      sendack(s, seqnum);
+    else if (!s->ackpending)
+      delayack(s, seqnum);
+    return;
+  }
+  if (!sr->bidirectional || sr->ackdelay <= 0.0) {
+    sendack(s, seqnum);
+    return;
+  }
+  flushack(s);
+  delayack(s, seqnum);
+}
+
+/********* Sender variables and functions ************/
+
+/* send the packet in slot, with the waiting ACK if there is one */
+static void transmit(struct srside *s, int slot)
+{
+  struct pkt *sendpkt = &s->buffer[slot];
+
+  sendpkt->acknum = NOTINUSE;
+  if (s->ackpending) {
+    sendpkt->acknum = sr->ackmode == ACK_SACK ? CUMACK(s) : s->pendingack;
+    s->ackpending = 0;
+    s->unacked = 0;
+    canceltimer(s, ACKSLOT);
+    stats->acks_piggybacked++;
+  }
+  sendpkt->checksum = ComputeChecksum(sendpkt); 
+  tolayer3_ptr(s->entity, sendpkt);
+}
+
+/* the receiver is missing seqnum, and has a packet that was first sent at sent */
+static void fastretransmit(struct srside *s, int seqnum, float sent)
+{
+  int slot = SLOT(seqnum);
+
+  if (SEQDIST(seqnum, s->windowfirst) >= SEQDIST(s->nextseqnum, s->windowfirst) ||
+      TESTBIT(s->acked, slot) || s->lastsent[slot] >= sent)
+    return;   /* not ours, or its last copy may still be on the way */
+  if (TRACEON(TRACE_SENDER, 1))
+    tprintf("----%c: NACK %d, fast retransmit\n", s->name, seqnum);
+  cutwindow(s, slot, 0);
+  transmit(s, slot);
+  stats->packets_resent++;
+  stats->fast_retransmits++;
+  SETBIT(s->resent, slot);
+  s->lastsent[slot] = currenttime();
+  settimer(s, slot, currenttime() + s->rto);
+  armtimer(s);
+}
+
+/* put a message into the next slot of the window and send it */
+static void sendmessage(struct srside *s, const struct msg *message)
+{
+  struct pkt *sendpkt;
+  int slot;
+
+  /* create packet directly in its slot of the window ring */
+  slot = SLOT(s->nextseqnum);
+  sendpkt = &s->buffer[slot];
+  sendpkt->seqnum = s->nextseqnum;
+  sendpkt->length = message->length;
+  memcpy(sendpkt->payload, message->data, message->length);
+  CLEARBIT(s->acked, slot);
+  s->windowcount++;
+
+  /* send out packet */
+  if (TRACEON(TRACE_SENDER, 1))
+    tprintf("Sending packet %d to layer 3\n", sendpkt->seqnum);
+  transmit(s, slot);
+
+  /* start the packet's own timer */
+  s->senttime[slot] = currenttime();
+  s->lastsent[slot] = currenttime();
+  CLEARBIT(s->resent, slot);
+  settimer(s, slot, currenttime() + s->rto);
+  armtimer(s);
+
+  /* get next sequence number, wrap back to 0 */
+  s->nextseqnum = SEQMOD(s->nextseqnum + 1);  
+}
+
+/* room for another packet: the receiver's window, and with --congestion
+   the congestion window, are not full */
+static bool windowopen(const struct srside *s)
+{
+  return SEQDIST(s->nextseqnum, s->windowfirst) < WINDOW &&
+         (!sr->congestion || s->windowcount < (int)s->cwnd);
+}
+
+/* send what the window has room for from the backlog, oldest first */
+static void drainbacklog(struct srside *s)
+{
+  struct queued *q;
+
+  while (s->qcount > 0 && windowopen(s))
+  {
+    q = &s->backlog[s->qfirst];
+    if (TRACEON(TRACE_SENDER, 2))
+      tprintf("----%c: window has room, sending message queued at %.3f\n", s->name, q->queuedat);
+    stats->messages_queued++;
+    stats->queue_delay += currenttime() - q->queuedat;
+    sendmessage(s, &q->message);
+    if (++s->qfirst == sr->qsize)
+      s->qfirst = 0;
+    s->qcount--;
+  }
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+static void output(struct srside *s, const struct msg *message)
+{
+  struct queued *q;
+
+  /* if not blocked waiting on ACK, and nothing queued ahead of it */
+  if (s->qcount == 0 && windowopen(s))
+  {
+    if (TRACEON(TRACE_SENDER, 2))
+      tprintf("----%c: New message arrives, send window is not full, send new messge to layer3!\n", s->name);
+    sendmessage(s, message);
+  }
+  /* if blocked, wait in the backlog for the window to slide */
+  else if (s->qcount < sr->qsize)
+  {
+    if (TRACEON(TRACE_SENDER, 1))
+      tprintf("----%c: New message arrives, send window is full, queued\n", s->name);
+    q = &s->backlog[(s->qfirst + s->qcount) % sr->qsize];
+    memcpy(&q->message, message, offsetof(struct msg, data) + message->length);
+    q->queuedat = currenttime();
+    s->qcount++;
+    if (s->qcount > stats->max_queue_depth)
+      stats->max_queue_depth = s->qcount;
   }
   /* if blocked,  window is full */
   else 
   {
-    if (TRACE > 0)
-      printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    if (TRACEON(TRACE_SENDER, 1))
+      tprintf("----%c: New message arrives, send window is full\n", s->name);
+    stats->window_full++;
   }
 }
 
+/* called from layer 3, when a packet carrying an ACK arrives
 
-/* called from layer 3, when a packet arrives for layer 4 
-   In this practical this will always be an ACK as B never sends data.
-
-  This function handles the ACKs received from receiver B.
+  This function handles the ACKs received from the other side.
   Unlike Go-Back-N, where a cumulative ACK causes the sender to slide its window all at once,
   Selective Repeat treats each ACK independently. Therefore:
   
-  1. We first check whether the ACK is corrupted.
-  2. Then we verify if the ACK falls within the current sender window.
-     Since sequence numbers wrap around in SR, we need to account for circular indexing.
-  3. If the ACK is valid and hasn't been seen before:
-     - We mark the corresponding packet as acknowledged in the buffer.
-     - If it ACKs the base of the window (windowfirst), we try to advance the window.
-       This is done by checking how many consecutive ACKs (starting from base) we’ve received.
-       We then shift the buffer, update the window start pointer, and restart the timer.
-  4. If the ACK is a duplicate (already marked), we simply ignore it.
-  5. If the ACK is not for the base but within the window, we still mark it as acknowledged.
-     It may help slide the window later when earlier packets get ACKed.
+  1. We first check whether the ACK is corrupted (done by input()).
+  2. Then we verify that the ACK is for a packet currently in the window,
+     i.e. between windowfirst and the last sequence number sent.
+  3. If the ACK is valid and hasn't been seen before, we set its bit in the
+     ACKed bitmap.
+  4. If it ACKs the base of the window (windowfirst), the window slides past
+     the run of consecutively ACKed packets.  The packets stay in the ring,
+     so sliding is just moving windowfirst; the bits of the slots left
+     behind are cleared when the slots are reused by sendmessage().
+  5. If the ACK is a duplicate (already marked), we simply ignore it.
 */
 
-void A_input(struct pkt packet)
+/* mark the packet in slot ACKed */
+static void ackslot(struct srside *s, int slot, int sample)
 {
-  int i;
-  int index;
-  int seqfirst;
-  int seqlast;
-  int ackcount = 0;
+  s->windowcount--;
+  stats->new_ACKs++;
+  SETBIT(s->acked, slot);
+  if (s->senttime[slot] > s->ackedsent)
+    s->ackedsent = s->senttime[slot];
+  growwindow(s);
+  if (sr->adaptive && sample && !TESTBIT(s->resent, slot))
+    rttsample(s, currenttime() - s->senttime[slot]);
+  else if (sr->adaptive && s->srtt > 0.0)
+    rtofromestimate(s);       /* no sample, but the path works again */
+  canceltimer(s, slot);
+}
+
+/* slide window past the ACKed packets at its base */
+static void slidewindow(struct srside *s)
+{
+  int ackcount;
+
+  ackcount = bitrun(s->acked, SLOT(s->windowfirst), SEQDIST(s->nextseqnum, s->windowfirst));
+  s->windowfirst = SEQMOD(s->windowfirst + ackcount);
+  if (ackcount > 0)
+    s->lastslide = currenttime();
+  drainbacklog(s);
+}
+
+/* a cumulative ACK of everything up to acknum, with a SACK bitmap of
+   the packets after it in the payload, handled in one pass over both */
+static void sackinput(struct srside *s, const struct pkt *packet)
+{
+  int inflight = SEQDIST(s->nextseqnum, s->windowfirst);
+  int cum = SEQDIST(packet->acknum, s->windowfirst);
+  int firstsacked = -1, lastsacked = -1;
+  int i, k, d, slot;
+  int maplength;
+  uint64_t bits;
+
+  /* a data packet carries the cumulative ACK only, its payload is data */
+  maplength = packet->seqnum == NOTINUSE ? packet->length : 0;
+
+  /* everything up to the cumulative ACK, if it is for a packet in flight */
+  if (cum < inflight) {
+    for (d = 0; d <= cum; d++) {
+      slot = SLOT(s->windowfirst + d);
+      if (!TESTBIT(s->acked, slot))
+        ackslot(s, slot, d == cum);
+    }
+  }
+  else
+    cum = -1;   /* an old ACK; the bitmap may still be news */
+
+  /* then the bitmap, taking the set bits of each word in turn */
+  d = SEQDIST(packet->acknum + 2, s->windowfirst);
+  for (i = 0; i < maplength; i += 8) {
+    bits = 0;
+    memcpy(&bits, packet->payload + i, maplength - i < 8 ? maplength - i : 8);
+    while (bits != 0) {
+      k = d + 8 * i + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      if (SEQMOD(k) >= inflight)
+        continue;
+      k = SEQMOD(k);
+      slot = SLOT(s->windowfirst + k);
+      if (!TESTBIT(s->acked, slot))
+        ackslot(s, slot, 0);
+      if (firstsacked < 0)
+        firstsacked = k;
+      lastsacked = k;
+    }
+  }
+
+  /* resend the holes below the last SACKed packet that must be lost */
+  if (sr->nack && lastsacked > 0) {
+    slot = SLOT(s->windowfirst + lastsacked);
+    for (d = cum + 1; d < lastsacked; d++)
+      if (!TESTBIT(s->acked, SLOT(s->windowfirst + d)))
+        fastretransmit(s, SEQMOD(s->windowfirst + d), s->senttime[slot]);
+  }
+  armtimer(s);
+  if (cum >= 0 || firstsacked == 0)
+    slidewindow(s);
+  else if (sr->congestion)
+    drainbacklog(s);    /* cwnd may have room now */
+}
 
-  /* Check if ACK is not corrupted */
-if (IsCorrupted(packet) == -1) 
+static void ackinput(struct srside *s, const struct pkt *packet)
 {
-  if (TRACE > 0)
-    printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-  total_ACKs_received++;
+  int slot;
 
-  /* check if new ACK or duplicate */
-  seqfirst = windowfirst;
-  seqlast = (windowfirst + WINDOWSIZE - 1) % SEQSPACE;
+  if (TRACEON(TRACE_SENDER, 1))
+    tprintf("----%c: uncorrupted ACK %d is received\n", s->name, packet->acknum);
+  stats->total_ACKs_received++;
+  if (sr->ackmode == ACK_SACK) {
+    sackinput(s, packet);
+    return;
+  }
 
-  /* Check if ACK is within the current sender window */
-  if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
-      ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) 
+  /* Check if ACK is for a packet in the current sender window */
+  if (SEQDIST(packet->acknum, s->windowfirst) < SEQDIST(s->nextseqnum, s->windowfirst)) 
   {
-    /* Calculate index of this ACK in the buffer */
-    if (packet.acknum >= seqfirst)
-      index = packet.acknum - seqfirst;
-    else
-      index = WINDOWSIZE - seqfirst + packet.acknum;
+    slot = SLOT(packet->acknum);
+    if (sr->nack && packet->length == 0 && packet->seqnum != NOTINUSE)
+      fastretransmit(s, packet->seqnum, s->senttime[slot]);
 
     /* If this ACK has not been received before */
-    if (buffer[index].acknum == NOTINUSE) 
+    if (!TESTBIT(s->acked, slot)) 
     {
-      if (TRACE > 0)
-        printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-      windowcount--;
-      new_ACKs++;
-      buffer[index].acknum = packet.acknum;
+      if (TRACEON(TRACE_SENDER, 1))
+        tprintf("----%c: ACK %d is not a duplicate\n", s->name, packet->acknum);
+      ackslot(s, slot, 1);
+      armtimer(s);
+
+      /* slide window past the ACKed packets at its base */
+      if (packet->acknum == s->windowfirst)
+        slidewindow(s);
+      else if (sr->congestion)
+        drainbacklog(s);    /* cwnd may have room now */
     } 
-      
     else 
     {
       /* Duplicate ACK, ignore */
-      if (TRACE > 0)
-        printf("----A: duplicate ACK received, do nothing!\n");
+      if (TRACEON(TRACE_SENDER, 1))
+        tprintf("----%c: duplicate ACK received, do nothing!\n", s->name);
     }
+  }
+}
 
-    /* compare it is the base one */
-    if (packet.acknum == seqfirst)
-    {
-      /* check how many concsecutive acks received in buffer */
-      for (i = 0; i < WINDOWSIZE; i++) 
-      {
-        if (buffer[i].acknum != NOTINUSE && strcmp(buffer[i].payload, "") != 0)
-          ackcount++;
-        else
-          break;
-      }
-      
-      /* slide window */
-      windowfirst = (windowfirst + ackcount) % SEQSPACE;
-
-      /* update buffer */
-      for (i = 0; i < WINDOWSIZE; i++)
-      {
-        if (buffer[i + ackcount].acknum == NOTINUSE || (buffer[i].seqnum + ackcount) % SEQSPACE == A_nextseqnum)
-          buffer[i] = buffer[i + ackcount];
-      }
+/* called when the side's timer goes off */
+/* Every packet whose own timer has expired is resent, oldest deadline
+   first, and its timer restarted; the others keep waiting.  With the
+   fixed timeout some expired timers are only restarted, see above.  A
+   delayed ACK that has waited long enough is sent on its own. */
+static void timerinterrupt(struct srside *s)
+{
+  int slot;
 
-      /* restart timer */
-      stoptimer(A);
-      if (windowcount > 0)
-        starttimer(A,RTT);
-    }
-    else
-    {
-      /* update buffer */
-      buffer[index].acknum = packet.acknum;
+  s->timerrunning = 0;
+  if (s->ackpending && s->tpos[ACKSLOT] >= 0 && s->deadline[ACKSLOT] <= s->armedfor)
+    flushack(s);
+  if (!sr->adaptive && s->lastslide + s->rto > s->armedfor)
+    while (s->tcount > 0 && s->deadline[s->theap[0]] <= s->armedfor)
+      settimer(s, s->theap[0], s->lastslide + s->rto);
+  if (s->tcount > 0 && s->deadline[s->theap[0]] <= s->armedfor) {
+    if (TRACEON(TRACE_SENDER, 1))
+      tprintf("----%c: time out,resend packets!\n", s->name);
+    if (sr->adaptive) {
+      s->rto = s->rto * 2 < RTOMAX ? s->rto * 2 : RTOMAX;
+      if (TRACEON(TRACE_SENDER, 2))
+        tprintf("----%c: timeout backed off to %.3f\n", s->name, s->rto);
     }
+    cutwindow(s, s->theap[0], 1);
   }
-  } 
-  else 
-  {
-    if (TRACE > 0)
-      printf("----A: corrupted ACK is received, do nothing!\n");
-    
-  }
-}
 
-/* called when A's timer goes off */
-/* When it is necessary to resend a packet, the oldest unacknowledged packet should be resent*/
-void A_timerinterrupt(void)
-{
-  /* Timeout occurred, resend the earliest unACKed packet */
-  if (TRACE > 0)
+  /* armedfor rather than the current time decides what has expired, so
+     rounding of the emulator's timer can never leave a packet behind */
+  while (s->tcount > 0 && s->deadline[slot = s->theap[0]] <= s->armedfor)
   {
-    printf("----A: time out,resend packets!\n");
-    printf("---A: resending packet %d\n", (buffer[0]).seqnum);
+    if (!sr->adaptive && slot != SLOT(s->windowfirst) && s->lastsent[slot] >= s->ackedsent) {
+      settimer(s, slot, currenttime() + s->rto);
+      continue;
+    }
+    if (TRACEON(TRACE_SENDER, 1))
+      tprintf("---%c: resending packet %d\n", s->name, s->buffer[slot].seqnum);
+    transmit(s, slot);
+    stats->packets_resent++;
+    SETBIT(s->resent, slot);
+    s->lastsent[slot] = currenttime();
+    settimer(s, slot, currenttime() + s->rto);
   }
-
-  tolayer3(A,buffer[0]);
-  packets_resent++;
-  starttimer(A,RTT);
+  armtimer(s);
 }
 
 /* the following routine will be called once (only) before any other */
-/* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+/* routines of a side are called. You can use it to do any initialization */
+static void initside(struct srside *s)
 {
-  /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
-		     new packets are placed in winlast + 1
-		     so initially this is set to -1
-		   */
-  windowcount = 0;
-}
+  int i;
+
+  /* initialise the window, buffer and sequence number */
+  s->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  s->windowfirst = 0;
+  s->windowcount = 0;
+  for (i = 0; i <= WINDOW; i++)
+    s->tpos[i] = -1;
+  s->tcount = 0;
+  s->timerrunning = 0;
+  s->srtt = 0.0;
+  s->rttvar = 0.0;
+  s->cwnd = 1.0;
+  s->ssthresh = WINDOW;
+  s->lastcut = -1.0;
+  s->lastslide = 0.0;
+  s->ackedsent = -1.0;
+  s->qfirst = 0;
+  s->qcount = 0;
 
+  s->expectedseqnum = 0;
+  s->ackpending = 0;
+  s->unacked = 0;
+}
 
 
-/********* Receiver (B)  variables and procedures ************/
+/********* Receiver variables and procedures ************/
 
-static struct pkt buffer_b[WINDOWSIZE];    /* array for storing packets waiting for packet from A */
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+/* see struct srside for the receiver's variables */
 
 /*
-1. Upon receiving a packet, the receiver first checks if the packet is corrupted.
-2. If the received packet is within the receiver's window and not a duplicate, it is marked as received in the window buffer and an ACK is sent back to the sender.
-3. Check if the received packet is the first one in the window. If it is, move the window forward (by the number of currently received packets plus any additional consecutive packets that have been acknowledged) and store the packet in the window buffer.
-4. If the received packet is not the first one in the window, store it temporarily.
-5. The check involves verifying whether the sequence number of the received packet matches the sequence number of the first packet in the window.
-6. If the received packet is not within the window or is a duplicate, it is not stored in the window buffer, but an ACK is still sent back to the sender.
+1. Upon receiving a packet, the receiver first checks if the packet is
+   corrupted (done by input()).
+2. Every uncorrupted packet is ACKed, including duplicates, since the
+   sender may have missed the earlier ACK.
+3. If the packet is within the receiver's window and its slot in the ring
+   is not yet marked as received, it is stored and marked.  Anything else
+   is a duplicate, recognised by its sequence number alone.
+4. If the packet is the base of the window, it and the run of buffered
+   packets after it are delivered to layer 5 in order, in one batch, and
+   the window moves past them.
 */
-
-
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+static void datainput(struct srside *s, const struct pkt *packet)
 {
-    struct pkt sendpkt;
-    int pckcount = 0;
-    int i;
-    int seqfirst;
-    int seqlast;
-    int index;
+  int pckcount;
+  int slot;
+  int i;
+  int inorder = 0;
 
-  /* if received packet is not corrupted */
-  if (IsCorrupted(packet) == -1) 
+  if (TRACEON(TRACE_RECEIVER, 1))
+    tprintf("----%c: packet %d is correctly received, send ACK!\n", s->name, packet->seqnum);
+  stats->packets_received++;
+
+  /* see if the packet received is inside the window, and new */
+  slot = SLOT(packet->seqnum);
+  if (SEQDIST(packet->seqnum, s->expectedseqnum) < WINDOW && !TESTBIT(s->received, slot))
   {
-    if (TRACE > 0)
-      printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
-    packets_received++;
-
-    /* deliver to receiving application */
-    tolayer5(B, packet.payload);
-
-    /* create sendpkt */
-    /* send an ACK foe the received packet */
-    sendpkt.acknum = packet.seqnum;
-    sendpkt.seqnum = NOTINUSE;
-
-    /* we don't have any data to send,fill payload with 0's */
-    for (i = 0; i < 20; i++)
-      sendpkt.payload[i] = '0';
-    
-    /* computer checksum */
-    sendpkt.checksum = ComputeChecksum(sendpkt);
-
-    /* send ack */
-    tolayer3(B,sendpkt);
-
-    /* need to check if new packet or duplicate */
-    seqfirst = B_nextseqnum;
-    seqlast = (B_nextseqnum + WINDOWSIZE - 1) % SEQSPACE;
-
-    /* see if the packet received is inside the window */
-    if (((seqfirst <= seqlast) && (packet.seqnum >= seqfirst && packet.seqnum <= seqlast)) ||
-          ((seqfirst > seqlast) && (packet.seqnum >= seqfirst || packet.seqnum <= seqlast)))
+    /* buffer it */
+    memcpy(&s->buffer_b[slot], packet, PKTSIZE(packet->length));
+    SETBIT(s->received, slot);
+
+    /* if it is the base, deliver it along with what was buffered behind it */
+    if (packet->seqnum == s->expectedseqnum)
     {
-      /* get index */
-      if (packet.seqnum >= seqfirst)
-        index = packet.seqnum - seqfirst;
-      
-      else
-        index = WINDOWSIZE - seqfirst + packet.seqnum;
-      
-      /* keep receivelast*/
-      B_nextseqnum = B_nextseqnum > index ? B_nextseqnum:index;
-
-      /* if not duplicate,save to buffer */
-
-      if (strcmp(buffer_b[index].payload, packet.payload) != 0)
+      pckcount = bitrun(s->received, slot, WINDOW);
+      for (i = 0; i < pckcount; i++)
       {
-        /* buffer it */
-        packet.acknum = packet.seqnum;
-        buffer_b[index] = packet;
-
-        /* if it is the base */
-        if (packet.seqnum == seqfirst)
-        {
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if (buffer_b[i].acknum >= 0 && strcmp(buffer_b[i].payload, "") != 0)
-              pckcount++;
-            else
-              break;
-          }
-
-          /* update state variables */
-          expectedseqnum = (expectedseqnum + pckcount) % SEQSPACE;
-
-          /* update buffer */
-          for (i = 0; i < WINDOWSIZE; i++)
-          {
-            if ((i + pckcount) <= (B_nextseqnum + 1))
-              buffer_b[i] = buffer_b[i + pckcount];
-          }
-
-        }
-        /* deliver to receiving application */
-        /* tolayer5(B,packet.payload);*/
+        tolayer5_len(s->entity, s->buffer_b[slot].payload, s->buffer_b[slot].length);
+        CLEARBIT(s->received, slot);
+        if (++slot == WINDOW)
+          slot = 0;
       }
+
+      /* update state variables */
+      s->expectedseqnum = SEQMOD(s->expectedseqnum + pckcount);
+      inorder = !hasany(s->received);
+    }
+  }
+  else if (TRACEON(TRACE_RECEIVER, 1))
+    tprintf("----%c: packet %d is a duplicate, not delivered\n", s->name, packet->seqnum);
+
+  ackpacket(s, packet->seqnum, inorder);
+}
+
+/* called from layer 3, when a packet arrives for layer 4; a packet with
+   a payload and a sequence number is data, and may carry an ACK too,
+   anything else is an ACK */
+static void input(struct srside *s, const struct pkt *packet)
+{
+  if (IsCorrupted(packet) != -1)
+  {
+    if (s->buffer_b == NULL || (s->buffer != NULL && packet->length == 0)) {
+      if (TRACEON(TRACE_SENDER, 1))
+        tprintf("----%c: corrupted ACK is received, do nothing!\n", s->name);
     }
-  }          
+    else if (TRACEON(TRACE_RECEIVER, 1))
+      tprintf("----%c: packet corrupted, do nothing!\n", s->name);
+    return;
+  }
+  if (packet->acknum != NOTINUSE && s->buffer != NULL)
+    ackinput(s, packet);
+  if (packet->length > 0 && packet->seqnum != NOTINUSE && s->buffer_b != NULL)
+    datainput(s, packet);
+}
+
+/********* The entry points of the two sides ************/
+
+void A_output_ptr(const struct msg *message)
+{
+  output(&sr->side[A], message);
+}
+
+void A_output(struct msg message)
+{
+  A_output_ptr(&message);
+}
+
+void A_input_ptr(const struct pkt *packet)
+{
+  input(&sr->side[A], packet);
+}
+
+void A_input(struct pkt packet)
+{
+  A_input_ptr(&packet);
+}
+
+void A_timerinterrupt(void)
+{
+  timerinterrupt(&sr->side[A]);
+}
+
+void A_init(void)
+{
+  initside(&sr->side[A]);
+}
+
+void B_input_ptr(const struct pkt *packet)
+{
+  input(&sr->side[B], packet);
+}
+
+void B_input(struct pkt packet)
+{
+  B_input_ptr(&packet);
 }
 
-/* the following routine will be called once (only) before any other */
-/* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = -1;
+  initside(&sr->side[B]);
 }
 
 /******************************************************************************
- * The following functions need be completed only for bi-directional messages *
+ * The following functions are only used for bi-directional messages         *
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
+void B_output_ptr(const struct msg *message)
+{
+  if (sr->bidirectional)
+    output(&sr->side[B], message);
+}
+
 void B_output(struct msg message)  
 {
+  B_output_ptr(&message);
 }
 
 /* called when B's timer goes off */
 void B_timerinterrupt(void)
 {
+  timerinterrupt(&sr->side[B]);
 }
-
@@ -1,11 +1,59 @@
+/* needs stdio.h */
+
+/* protocol parameters, set by name from the command line or a sweep */
+struct srconfig {
+  int windowsize;         /* the maximum number of buffered unacked packets */
+  int adaptive;           /* estimate the timeout from measured round trips */
+  float timeout;          /* the fixed timeout, and the first one when adaptive */
+  int nack;               /* the receiver NACKs its missing base */
+  int backlog;            /* messages queued while the window is full, 0 drops them */
+  int checksum;           /* 0 the original sum, 1 the Internet checksum, 2 CRC32C */
+  int bidirectional;      /* B sends data to A as well */
+  float ackdelay;         /* how long an ACK may wait for data, or for more packets */
+  int ackmode;            /* 0 an ACK per packet, 1 cumulative ACK with SACK bitmap */
+  int ackevery;           /* with ackmode 1, in-order packets per ACK */
+  int congestion;         /* limit the packets in flight with an AIMD congestion window */
+};
+
+extern void sr_defaults(struct srconfig *);
+/* returns 1 if set, 0 for a bad value and -1 if the name is not a protocol parameter */
+extern int sr_setparam(struct srconfig *, const char *name, const char *value);
+
+/* protocol state: one per simulation, made current with sr_select() */
+extern void *sr_create(const struct srconfig *);
+extern void sr_destroy(void *);
+extern void sr_select(void *);
+
+/* the state of one side's sender in the current protocol state, for
+   sampling; all zero for a side that does not send */
+struct srsnapshot {
+  int window;             /* sequence numbers in use, ACKed or not */
+  int inflight;           /* packets sent and not yet ACKed */
+  int queued;             /* messages waiting in the backlog */
+  float cwnd;             /* the congestion window, or the window size without one */
+};
+
+extern void sr_snapshot(int entity, struct srsnapshot *);
+
+/* write the current protocol state to a checkpoint, or with saving 0
+   read it back into a state created with the same window, backlog and
+   direction; returns 0 on a read or write error or a mismatch */
+extern int sr_checkpoint(FILE *, int saving);
+
+/* the routines the emulator calls; each one taking a struct also has a
+   _ptr version that takes it by pointer, which the emulator uses so that
+   packets and messages are not copied on the way in */
 extern void A_init(void);
 extern void B_init(void);
 extern void A_input(struct pkt);
 extern void B_input(struct pkt);
 extern void A_output(struct msg);
+extern void A_input_ptr(const struct pkt *);
+extern void B_input_ptr(const struct pkt *);
+extern void A_output_ptr(const struct msg *);
 extern void A_timerinterrupt(void);
 
-/* included for extension to bidirectional communication */
-#define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
+/* used for bidirectional communication, see srconfig.bidirectional */
 extern void B_output(struct msg);
+extern void B_output_ptr(const struct msg *);
 extern void B_timerinterrupt(void);
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "emulator.h"
+#include "sr.h"
+#include "sim.h"
+#include "sweep.h"
+
+/* ******************************************************************
+   Parameter sweep driver.  Every grid point is an independent
+   simulation with its own struct simulator and protocol state, so the
+   worker threads share nothing but the index of the next point to run.
+   *******************************************************************/
+
+#define MAXDIMS 16
+
+struct dimension {
+  char *name;
+  char **values;          /* each value as text, handed to setparam() */
+  int nvalues;
+};
+
+struct sweep {
+  struct dimension dims[MAXDIMS];
+  int ndims;
+  int npoints;
+  struct simconfig *configs;      /* one per grid point */
+  struct simresult *results;
+  atomic_int next;                /* next point to be taken by a worker */
+};
+
+static int addvalue(struct dimension *dim, const char *value)
+{
+  char **values;
+
+  values = realloc(dim->values, (dim->nvalues + 1) * sizeof(char *));
+  if (values == NULL)
+    return 0;
+  dim->values = values;
+  if ((dim->values[dim->nvalues] = strdup(value)) == NULL)
+    return 0;
+  dim->nvalues++;
+  return 1;
+}
+
+/* expand start:stop:step into values; stop is included if the step lands on it */
+static int addrange(struct dimension *dim, const char *range)
+{
+  double start, stop, step, v;
+  char buf[32];
+  int i, n;
+
+  if (sscanf(range, "%lf:%lf:%lf", &start, &stop, &step) != 3 || step <= 0.0 || stop < start) {
+    printf("bad range for %s: %s\n", dim->name, range);
+    return 0;
+  }
+  n = (int)((stop - start) / step + 1e-9) + 1;
+  for (i = 0; i < n; i++) {
+    v = start + i * step;
+    sprintf(buf, "%.10g", v);
+    if (!addvalue(dim, buf))
+      return 0;
+  }
+  return 1;
+}
+
+static int parsedimension(struct sweep *sw, char *spec)
+{
+  struct dimension *dim;
+  struct simconfig scratch;
+  char *eq, *value, *save;
+  int i;
+
+  if ((eq = strchr(spec, '=')) == NULL) {
+    printf("expected name=values in sweep grid: %s\n", spec);
+    return 0;
+  }
+  if (sw->ndims == MAXDIMS) {
+    printf("too many sweep dimensions (at most %d)\n", MAXDIMS);
+    return 0;
+  }
+  *eq = '\0';
+  dim = &sw->dims[sw->ndims++];
+  if ((dim->name = strdup(spec)) == NULL)
+    return 0;
+  if (strchr(eq + 1, ':') != NULL) {
+    if (!addrange(dim, eq + 1))
+      return 0;
+  }
+  else
+    for (value = strtok_r(eq + 1, ",", &save); value != NULL; value = strtok_r(NULL, ",", &save))
+      if (!addvalue(dim, value))
+        return 0;
+  if (dim->nvalues == 0) {
+    printf("no values for %s in sweep grid\n", dim->name);
+    return 0;
+  }
+
+  /* catch bad names and values before any simulation starts */
+  simdefaults(&scratch);
+  for (i = 0; i < dim->nvalues; i++)
+    if (!setparam(&scratch, dim->name, dim->values[i]))
+      return 0;
+  return 1;
+}
+
+static int parsegrid(struct sweep *sw, const char *grid)
+{
+  char *copy, *spec, *save;
+  int ok = 1;
+
+  if ((copy = strdup(grid)) == NULL)
+    return 0;
+  for (spec = strtok_r(copy, " \t;", &save); ok && spec != NULL; spec = strtok_r(NULL, " \t;", &save))
+    ok = parsedimension(sw, spec);
+  free(copy);
+  if (ok && sw->ndims == 0) {
+    printf("empty sweep grid\n");
+    ok = 0;
+  }
+  return ok;
+}
+
+/* the configuration of every point; the last dimension varies fastest */
+static int makeconfigs(struct sweep *sw, const struct simconfig *base)
+{
+  int i, d, k;
+
+  sw->npoints = 1;
+  for (d = 0; d < sw->ndims; d++)
+    sw->npoints *= sw->dims[d].nvalues;
+  sw->configs = malloc(sw->npoints * sizeof(struct simconfig));
+  sw->results = malloc(sw->npoints * sizeof(struct simresult));
+  if (sw->configs == NULL || sw->results == NULL) {
+    printf("memory allocation for sweep failed.");
+    return 0;
+  }
+  for (i = 0; i < sw->npoints; i++) {
+    sw->configs[i] = *base;
+    sw->configs[i].trace = 0;     /* traces from many threads would interleave */
+    k = i;
+    for (d = sw->ndims - 1; d >= 0; d--) {
+      setparam(&sw->configs[i], sw->dims[d].name, sw->dims[d].values[k % sw->dims[d].nvalues]);
+      k /= sw->dims[d].nvalues;
+    }
+  }
+  return 1;
+}
+
+static void *worker(void *arg)
+{
+  struct sweep *sw = arg;
+  int i;
+
+  while ((i = atomic_fetch_add(&sw->next, 1)) < sw->npoints)
+    runsim(&sw->configs[i], &sw->results[i]);
+  return NULL;
+}
+
+static void freesweep(struct sweep *sw)
+{
+  int d, i;
+
+  for (d = 0; d < sw->ndims; d++) {
+    for (i = 0; i < sw->dims[d].nvalues; i++)
+      free(sw->dims[d].values[i]);
+    free(sw->dims[d].values);
+    free(sw->dims[d].name);
+  }
+  free(sw->configs);
+  free(sw->results);
+}
+
+int runsweep(const struct simconfig *base, const char *grid, int nthreads,
+             FILE *out, int format, int header)
+{
+  struct sweep sw;
+  pthread_t *threads;
+  int started, i;
+
+  memset(&sw, 0, sizeof(sw));
+  if (!parsegrid(&sw, grid) || !makeconfigs(&sw, base)) {
+    freesweep(&sw);
+    return 0;
+  }
+  atomic_init(&sw.next, 0);
+  if (nthreads < 1)
+    nthreads = 1;
+  if (nthreads > sw.npoints)
+    nthreads = sw.npoints;
+
+  threads = malloc(nthreads * sizeof(pthread_t));
+  if (threads == NULL) {
+    printf("memory allocation for sweep failed.");
+    freesweep(&sw);
+    return 0;
+  }
+  for (started = 0; started < nthreads; started++)
+    if (pthread_create(&threads[started], NULL, worker, &sw) != 0)
+      break;
+  if (started == 0)
+    worker(&sw);              /* no threads available, run them here */
+  for (i = 0; i < started; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+
+  for (i = 0; i < sw.npoints; i++)
+    writeresult(out, format, header && i == 0, &sw.configs[i], &sw.results[i]);
+  freesweep(&sw);
+  return 1;
+}
@@ -0,0 +1,11 @@
+/* Parameter sweeps: run the simulation at every point of a grid of
+   parameter values, spreading the points over a pool of threads.
+
+   A grid is a list of dimensions separated by spaces or ';', each one
+   either "name=v1,v2,..." or "name=start:stop:step", where name is any
+   parameter accepted by setparam().  Results are written one row per
+   point, in grid order, whatever order the threads finish in. */
+
+/* returns 0 if the grid could not be parsed */
+extern int runsweep(const struct simconfig *base, const char *grid, int nthreads,
+                    FILE *out, int format, int header);
@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "emulator.h"
+#include "trace.h"
+
+/* ******************************************************************
+   Trace sink.  The simulation formats each trace line into a small
+   buffer on its stack and copies it into the ring; only the writer
+   thread touches stdout.  The ring has one producer and one consumer,
+   so the two only take the lock to wake each other up.
+   *******************************************************************/
+
+#ifndef TRACEBUF
+#define TRACEBUF (16 << 20)     /* bytes in the ring, a power of two */
+#endif
+#define TRACEBLOCK 65536        /* wake the writer once this much is waiting */
+#define TRACELINE  512          /* longer lines are formatted on the heap */
+#define TRACEPOLL  100          /* ms; the writer also looks this often */
+
+_Thread_local int TRACEMASK = TRACE_ALL;
+
+static struct {
+  char *buf;
+  atomic_size_t head;             /* bytes put in so far, by the simulation */
+  atomic_size_t tail;             /* bytes written out so far, by the writer */
+  size_t woken;                   /* head when the writer was last woken */
+  int stop;
+  pthread_mutex_t lock;
+  pthread_cond_t more;            /* there is something to write */
+  pthread_cond_t room;            /* something has been written */
+  pthread_t writer;
+} ring = { .lock = PTHREAD_MUTEX_INITIALIZER, .more = PTHREAD_COND_INITIALIZER,
+           .room = PTHREAD_COND_INITIALIZER };
+
+static _Thread_local int buffered;    /* this thread traces into the ring */
+
+static void *writer(void *arg)
+{
+  struct timespec until;
+  size_t head, tail, start, n;
+
+  (void)arg;
+  pthread_mutex_lock(&ring.lock);
+  for (;;) {
+    tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring.head, memory_order_acquire);
+    if (head == tail) {
+      if (ring.stop)
+        break;
+      clock_gettime(CLOCK_REALTIME, &until);
+      until.tv_nsec += TRACEPOLL * 1000000L;
+      if (until.tv_nsec >= 1000000000L) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+      }
+      pthread_cond_timedwait(&ring.more, &ring.lock, &until);
+      continue;
+    }
+    pthread_mutex_unlock(&ring.lock);
+    while (tail != head) {
+      start = tail & (TRACEBUF - 1);
+      n = head - tail < TRACEBUF - start ? head - tail : TRACEBUF - start;
+      fwrite(ring.buf + start, 1, n, stdout);
+      tail += n;
+    }
+    fflush(stdout);
+    pthread_mutex_lock(&ring.lock);
+    atomic_store_explicit(&ring.tail, tail, memory_order_release);
+    pthread_cond_signal(&ring.room);
+  }
+  pthread_mutex_unlock(&ring.lock);
+  return NULL;
+}
+
+/* have the writer look at the ring, and if full wait for it to write */
+static void wakewriter(size_t head, int full)
+{
+  pthread_mutex_lock(&ring.lock);
+  ring.woken = head;
+  pthread_cond_signal(&ring.more);
+  while (full && head - atomic_load_explicit(&ring.tail, memory_order_acquire) == TRACEBUF)
+    pthread_cond_wait(&ring.room, &ring.lock);
+  pthread_mutex_unlock(&ring.lock);
+}
+
+static void put(const char *p, size_t n)
+{
+  size_t head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+  size_t start, room, k;
+
+  while (n > 0) {
+    room = TRACEBUF - (head - atomic_load_explicit(&ring.tail, memory_order_acquire));
+    if (room == 0) {
+      wakewriter(head, 1);
+      continue;
+    }
+    start = head & (TRACEBUF - 1);
+    k = n < room ? n : room;
+    if (k > TRACEBUF - start)
+      k = TRACEBUF - start;
+    memcpy(ring.buf + start, p, k);
+    head += k;
+    atomic_store_explicit(&ring.head, head, memory_order_release);
+    p += k;
+    n -= k;
+  }
+  if (head - ring.woken >= TRACEBLOCK)
+    wakewriter(head, 0);
+}
+
+void tprintf(const char *fmt, ...)
+{
+  char line[TRACELINE];
+  char *big;
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  if (!buffered) {
+    vprintf(fmt, ap);
+    va_end(ap);
+    return;
+  }
+  n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n < (int)sizeof(line)) {
+    if (n > 0)
+      put(line, n);
+    return;
+  }
+  if ((big = malloc(n + 1)) == NULL)
+    return;
+  va_start(ap, fmt);
+  vsnprintf(big, n + 1, fmt, ap);
+  va_end(ap);
+  put(big, n);
+  free(big);
+}
+
+void tracebytes(const char *p, int n)
+{
+  if (n <= 0)
+    return;
+  if (buffered)
+    put(p, n);
+  else
+    fwrite(p, 1, n, stdout);
+}
+
+void trace_start(void)
+{
+  static int registered;
+
+  if (buffered || (ring.buf = malloc(TRACEBUF)) == NULL)
+    return;     /* without the memory, trace straight to stdout */
+  fflush(stdout);
+  ring.stop = 0;
+  if (pthread_create(&ring.writer, NULL, writer, NULL) != 0) {
+    free(ring.buf);
+    ring.buf = NULL;
+    return;
+  }
+  buffered = 1;
+  if (!registered) {
+    atexit(trace_stop);     /* so exit() on an error still writes the trace */
+    registered = 1;
+  }
+}
+
+void trace_stop(void)
+{
+  if (!buffered)
+    return;
+  pthread_mutex_lock(&ring.lock);
+  ring.stop = 1;
+  pthread_cond_signal(&ring.more);
+  pthread_mutex_unlock(&ring.lock);
+  pthread_join(ring.writer, NULL);
+  free(ring.buf);
+  ring.buf = NULL;
+  buffered = 0;
+}
@@ -0,0 +1,27 @@
+/* needs emulator.h */
+
+/* Trace output.  A simulation run from the command line traces into a
+   large ring buffer in memory that a writer thread empties to stdout in
+   big blocks, so the simulation only waits for the terminal if the ring
+   fills up.  On other threads, such as those of a sweep, tprintf() is
+   printf().  Each trace point belongs to a subsystem, and
+   --trace-filter picks the subsystems that are traced. */
+
+#define TRACE_SCHEDULER 0x1     /* the event list, timers and the main loop */
+#define TRACE_CHANNEL   0x2     /* layer 3 and layer 5 */
+#define TRACE_SENDER    0x4
+#define TRACE_RECEIVER  0x8
+#define TRACE_ALL       0xf
+
+extern _Thread_local int TRACEMASK;
+
+#define TRACEON(subsys, level) (TRACING(level) && (TRACEMASK & (subsys)))
+
+extern void tprintf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+/* n bytes as they are, e.g. a payload */
+extern void tracebytes(const char *p, int n);
+
+/* trace through the ring from the calling thread until trace_stop(),
+   which writes out what is left */
+extern void trace_start(void);
+extern void trace_stop(void);